@@ -0,0 +1,41 @@
+#ifndef DATAMAPPERCPP_BLOB_H__
+#define DATAMAPPERCPP_BLOB_H__
+
+#include <datamappercpp/Field.h>
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace dm
+{
+
+/**
+ * Binary entity field, stored as BLOB.
+ */
+typedef std::vector<unsigned char> Blob;
+
+/**
+ * Non-owning view of binary data, for writing blobs without copying them
+ * into a Blob first.
+ */
+struct BlobSpan
+{
+    const unsigned char* data;
+    size_t size;
+
+    BlobSpan(const unsigned char* d, size_t s) :
+        data(d), size(s)
+    { }
+
+    BlobSpan(const Blob& blob) :
+        data(blob.empty() ? 0 : &blob[0]), size(blob.size())
+    { }
+};
+
+template <>
+std::string Field<Blob>::getType() const { return "BLOB"; }
+
+}
+
+#endif /* DATAMAPPERCPP_BLOB_H__ */
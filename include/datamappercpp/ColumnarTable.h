@@ -0,0 +1,187 @@
+#ifndef DATAMAPPERCPP_COLUMNARTABLE_H__
+#define DATAMAPPERCPP_COLUMNARTABLE_H__
+
+#include <utilcpp/release_assert.h>
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace dm
+{
+
+/**
+ * Column-oriented image of a mapped table: one contiguous array per field
+ * instead of one entity object per row.
+ *
+ * Integer and real columns are plain arrays, text columns are stored in a
+ * single character arena with per-row offsets.
+ */
+class ColumnarTable
+{
+public:
+    enum ColumnType
+    {
+        INTEGER_COLUMN,
+        REAL_COLUMN,
+        TEXT_COLUMN
+    };
+
+    struct Column
+    {
+        std::string label;
+        ColumnType type;
+
+        std::vector<int64_t> integers;
+        std::vector<double> reals;
+
+        // All values of a text column concatenated, value of row i is
+        // text[offsets[i], offsets[i + 1]).
+        std::string text;
+        std::vector<size_t> offsets;
+
+        Column(const std::string& l, ColumnType t) :
+            label(l), type(t), integers(), reals(), text(), offsets(1, 0)
+        { }
+
+        const char* textData(size_t row) const
+        { return text.data() + offsets[row]; }
+
+        size_t textLength(size_t row) const
+        { return offsets[row + 1] - offsets[row]; }
+
+        std::string textAt(size_t row) const
+        { return std::string(textData(row), textLength(row)); }
+    };
+
+    typedef std::vector<Column> Columns;
+
+    std::vector<int64_t> ids;
+    Columns columns;
+
+    ColumnarTable() :
+        ids(), columns()
+    { }
+
+    size_t size() const
+    { return ids.size(); }
+
+    const Column& column(const std::string& label) const
+    {
+        for (size_t i = 0; i < columns.size(); ++i)
+            if (columns[i].label == label)
+                return columns[i];
+
+        UTILCPP_RELEASE_ASSERT(false, "Unknown column");
+        return columns.front(); // unreachable
+    }
+};
+
+namespace detail
+{
+
+template <typename T>
+struct ColumnTraits;
+
+template <>
+struct ColumnTraits<int>
+{
+    static const ColumnarTable::ColumnType type =
+        ColumnarTable::INTEGER_COLUMN;
+
+    static void append(ColumnarTable::Column& column, int value)
+    { column.integers.push_back(value); }
+
+    static int at(const ColumnarTable::Column& column, size_t row)
+    { return static_cast<int>(column.integers[row]); }
+};
+
+template <>
+struct ColumnTraits<int64_t>
+{
+    static const ColumnarTable::ColumnType type =
+        ColumnarTable::INTEGER_COLUMN;
+
+    static void append(ColumnarTable::Column& column, int64_t value)
+    { column.integers.push_back(value); }
+
+    static int64_t at(const ColumnarTable::Column& column, size_t row)
+    { return column.integers[row]; }
+};
+
+template <>
+struct ColumnTraits<uint32_t>
+{
+    static const ColumnarTable::ColumnType type =
+        ColumnarTable::INTEGER_COLUMN;
+
+    static void append(ColumnarTable::Column& column, uint32_t value)
+    { column.integers.push_back(value); }
+
+    static uint32_t at(const ColumnarTable::Column& column, size_t row)
+    { return static_cast<uint32_t>(column.integers[row]); }
+};
+
+template <>
+struct ColumnTraits<uint64_t>
+{
+    static const ColumnarTable::ColumnType type =
+        ColumnarTable::INTEGER_COLUMN;
+
+    static void append(ColumnarTable::Column& column, uint64_t value)
+    { column.integers.push_back(static_cast<int64_t>(value)); }
+
+    static uint64_t at(const ColumnarTable::Column& column, size_t row)
+    { return static_cast<uint64_t>(column.integers[row]); }
+};
+
+template <>
+struct ColumnTraits<bool>
+{
+    static const ColumnarTable::ColumnType type =
+        ColumnarTable::INTEGER_COLUMN;
+
+    static void append(ColumnarTable::Column& column, bool value)
+    { column.integers.push_back(value ? 1 : 0); }
+
+    static bool at(const ColumnarTable::Column& column, size_t row)
+    { return column.integers[row] != 0; }
+};
+
+template <>
+struct ColumnTraits<double>
+{
+    static const ColumnarTable::ColumnType type =
+        ColumnarTable::REAL_COLUMN;
+
+    static void append(ColumnarTable::Column& column, double value)
+    { column.reals.push_back(value); }
+
+    static double at(const ColumnarTable::Column& column, size_t row)
+    { return column.reals[row]; }
+};
+
+template <>
+struct ColumnTraits<std::string>
+{
+    static const ColumnarTable::ColumnType type =
+        ColumnarTable::TEXT_COLUMN;
+
+    static void append(ColumnarTable::Column& column,
+                       const std::string& value)
+    {
+        column.text.append(value);
+        column.offsets.push_back(column.text.size());
+    }
+
+    static std::string at(const ColumnarTable::Column& column, size_t row)
+    { return column.textAt(row); }
+};
+
+}
+
+}
+
+#endif /* DATAMAPPERCPP_COLUMNARTABLE_H__ */
@@ -4,6 +4,8 @@
 #include <string>
 #include <sstream>
 
+#include <stdint.h>
+
 #include <utilcpp/release_assert.h>
 
 namespace dm
@@ -44,6 +46,16 @@ private:
 template <>
 std::string Field<int>::getType() const { return "INT"; }
 
+template <>
+std::string Field<int64_t>::getType() const { return "INTEGER"; }
+
+template <>
+std::string Field<uint32_t>::getType() const { return "INTEGER"; }
+
+// stored with the bits of the corresponding signed value
+template <>
+std::string Field<uint64_t>::getType() const { return "INTEGER"; }
+
 // TODO: add CHECK( in { 0, 1 } )
 template <>
 std::string Field<bool>::getType() const { return "INT"; }
@@ -0,0 +1,87 @@
+#ifndef DATAMAPPERCPP_INDEX_H__
+#define DATAMAPPERCPP_INDEX_H__
+
+#include <string>
+#include <vector>
+
+namespace dm
+{
+
+/**
+ * Index over one or more fields, declared in the optional
+ *
+ *   static void declareIndexes(dm::Indexes& indexes)
+ *
+ * of a mapping and created with the table:
+ *
+ *   indexes.push_back(dm::Index("age"));
+ *   indexes.push_back(dm::Index("name").on("age").unique());
+ *   indexes.push_back(dm::Index("email").where("email IS NOT NULL"));
+ *
+ * The name defaults to <table>_<fields>_idx.
+ */
+class Index
+{
+public:
+    explicit Index(const std::string& field) :
+        _name(), _fields(1, field), _unique(false), _condition()
+    { }
+
+    // adds a field to a composite index
+    Index& on(const std::string& field)
+    {
+        _fields.push_back(field);
+        return *this;
+    }
+
+    Index& unique()
+    {
+        _unique = true;
+        return *this;
+    }
+
+    // makes a partial index over the rows matching the condition
+    Index& where(const std::string& condition)
+    {
+        _condition = condition;
+        return *this;
+    }
+
+    Index& named(const std::string& name)
+    {
+        _name = name;
+        return *this;
+    }
+
+    std::string name(const std::string& table) const
+    {
+        if (!_name.empty())
+            return _name;
+
+        std::string name(table);
+        for (size_t i = 0; i < _fields.size(); ++i)
+            name += "_" + _fields[i];
+        return name + "_idx";
+    }
+
+    const std::vector<std::string>& fields() const
+    { return _fields; }
+
+    bool isUnique() const
+    { return _unique; }
+
+    const std::string& condition() const
+    { return _condition; }
+
+private:
+    std::string _name;
+    std::vector<std::string> _fields;
+    bool _unique;
+    std::string _condition;
+};
+
+typedef std::vector<Index> Indexes;
+
+}
+
+#endif /* DATAMAPPERCPP_INDEX_H__ */
@@ -0,0 +1,103 @@
+#ifndef DATAMAPPERCPP_LAZY_H__
+#define DATAMAPPERCPP_LAZY_H__
+
+#include <datamappercpp/Field.h>
+
+#include <datamappercpp/sql/detail/stdutil.h>
+
+#include <string>
+
+namespace dm
+{
+
+/**
+ * Entity field that is not loaded with the rest of the entity, but fetched
+ * by id on first access.
+ *
+ * Use for large columns that most readers do not need. SELECT statements
+ * generated by the repository skip lazy columns, Repository::Prefetch()
+ * loads a lazy field for a whole collection with a single query.
+ *
+ * A lazy value that has been assigned or loaded behaves like a plain
+ * value. Saving an entity with an unloaded lazy field loads it first.
+ *
+ * Any field type can be lazy, Lazy<Blob> fields are read and written with
+ * incremental blob I/O like plain Blob fields.
+ */
+template <typename T>
+class Lazy
+{
+public:
+    typedef stdutil::function<T (void)> Loader;
+
+    Lazy() :
+        _value(), _loaded(true), _loader()
+    { }
+
+    Lazy(const T& value) :
+        _value(value), _loaded(true), _loader()
+    { }
+
+    Lazy& operator=(const T& value)
+    {
+        set(value);
+        return *this;
+    }
+
+    const T& get() const
+    {
+        if (!_loaded)
+        {
+            _value = _loader();
+            _loaded = true;
+        }
+        return _value;
+    }
+
+    operator const T&() const
+    { return get(); }
+
+    bool isLoaded() const
+    { return _loaded; }
+
+    void set(const T& value)
+    {
+        _value = value;
+        _loaded = true;
+        _loader = Loader();
+    }
+
+    void setLoader(const Loader& loader)
+    {
+        _value = T();
+        _loaded = false;
+        _loader = loader;
+    }
+
+private:
+    mutable T _value;
+    mutable bool _loaded;
+    Loader _loader;
+};
+
+// Lazy columns have the column type of the value type.
+template <typename T>
+struct Field<Lazy<T> >
+{
+    const std::string& label;
+    const std::string& options;
+
+    Field(const std::string& l,
+          const std::string& o = std::string()) :
+        label(l), options(o)
+    { }
+
+    std::string typeDefinition() const
+    {
+        return Field<T>(label, options).typeDefinition();
+    }
+};
+
+}
+
+#endif /* DATAMAPPERCPP_LAZY_H__ */
@@ -0,0 +1,90 @@
+#ifndef DATAMAPPERCPP_VERSION_H__
+#define DATAMAPPERCPP_VERSION_H__
+
+#include <datamappercpp/Field.h>
+
+#include <datamappercpp/sql/detail/stdutil.h>
+
+#include <stdint.h>
+
+namespace dm
+{
+
+/**
+ * Outcome of the transaction that a save ran in, shared by the versions
+ * that the save changed while the transaction was still open.
+ */
+struct TransactionOutcome
+{
+    bool rolledBack;
+
+    TransactionOutcome() :
+        rolledBack(false)
+    { }
+};
+
+typedef stdutil::shared_ptr<TransactionOutcome> TransactionOutcomePtr;
+
+/**
+ * Row version for optimistic concurrency control, mapped with
+ * dm::Field<dm::Version>("version").
+ *
+ * Inserts start the version at 1. Updates only succeed if the row still
+ * has the version that was loaded, and increment it, otherwise
+ * Repository::Save() throws ConcurrentModificationError. The repository
+ * maintains the value, entities should not change it.
+ *
+ * A save inside an enclosing transaction changes the version before the
+ * transaction commits. If the transaction is rolled back, the version
+ * returns to the value it had before the save.
+ */
+class Version
+{
+public:
+    Version() :
+        _value(0), _previous(0), _outcome()
+    { }
+
+    explicit Version(int64_t value) :
+        _value(value), _previous(0), _outcome()
+    { }
+
+    int64_t value() const
+    { return _outcome && _outcome->rolledBack ? _previous : _value; }
+
+    void set(int64_t value)
+    {
+        _value = value;
+        _outcome.reset();
+    }
+
+    // Sets the value that a save in the still open transaction of outcome
+    // wrote, earlier saves in the same transaction keep the value to
+    // return to.
+    void set(int64_t value, const TransactionOutcomePtr& outcome)
+    {
+        if (_outcome != outcome)
+            _previous = this->value();
+        _value = value;
+        _outcome = outcome;
+    }
+
+    bool operator==(const Version& rhs) const
+    { return value() == rhs.value(); }
+
+    bool operator!=(const Version& rhs) const
+    { return value() != rhs.value(); }
+
+private:
+    int64_t _value;
+    int64_t _previous;
+    TransactionOutcomePtr _outcome;
+};
+
+template <>
+std::string Field<Version>::getType() const
+{ return "INTEGER NOT NULL DEFAULT 1"; }
+
+}
+
+#endif /* DATAMAPPERCPP_VERSION_H__ */
@@ -0,0 +1,357 @@
+#ifndef DATAMAPPERCPP_ASYNCREPOSITORY_H__
+#define DATAMAPPERCPP_ASYNCREPOSITORY_H__
+
+#include <datamappercpp/sql/Repository.h>
+
+#include <datamappercpp/sql/detail/DbWorker.h>
+
+#include <datamappercpp/Field.h>
+#include <datamappercpp/Lazy.h>
+
+#include <utilcpp/disable_copy.h>
+
+#include <exception>
+#include <functional>
+#include <memory>
+#include <utility>
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+  #include <coroutine>
+  #define DATAMAPPERCPP_HAS_COROUTINES 1
+#endif
+
+namespace dm {
+namespace sql {
+
+/**
+ * Loads the lazy fields of an entity. Their loaders use the connection,
+ * so AsyncRepository runs them on the worker before handing entities to
+ * other threads.
+ */
+class LazyFieldFetcher
+{
+    UTILCPP_DISABLE_COPY(LazyFieldFetcher)
+
+public:
+    LazyFieldFetcher()
+    { }
+
+    template <typename T>
+    void visitField(const Field<T>& , const T& )
+    { }
+
+    template <typename T>
+    void visitField(const Field<Lazy<T> >& , const Lazy<T>& field)
+    {
+        field.get();
+    }
+};
+
+#ifdef DATAMAPPERCPP_HAS_COROUTINES
+// Result of an awaited job, void results only carry the error.
+template <typename T>
+struct AwaitedResult
+{
+    T value;
+
+    void run(const std::function<T ()>& job)
+    { value = job(); }
+
+    T take()
+    { return std::move(value); }
+};
+
+template <>
+struct AwaitedResult<void>
+{
+    void run(const std::function<void ()>& job)
+    { job(); }
+
+    void take()
+    { }
+};
+#endif
+
+/**
+ * Asynchronous access to a Repository for threads that must not block on
+ * the database, e.g. event loops. The repository calls run on the
+ * DbWorker thread and their results are delivered to callbacks through
+ * the completion executor of the worker:
+ *
+ *   dm::sql::DbWorker::instance().setCompletionExecutor(
+ *       [&loop](dm::sql::DbWorker::Job job) { loop.post(job); });
+ *
+ *   PersonAsync::GetAsync(1, [](std::exception_ptr error, Person p) {
+ *       ...
+ *   });
+ *
+ * With C++20 coroutines the operations can be awaited instead:
+ *
+ *   Person p = co_await PersonAsync::GetAsync(1);
+ *
+ * Synchronous Repository calls from other threads must not overlap with
+ * pending asynchronous operations, as they share the connection. For the
+ * same reason the entities are delivered with their lazy fields already
+ * loaded, and blob fields are read on the worker as part of the entity.
+ */
+template <class Entity, class Mapping>
+class AsyncRepository
+{
+public:
+    typedef Repository<Entity, Mapping> EntityRepository;
+    typedef typename EntityRepository::Entities Entities;
+    typedef typename EntityRepository::Id Id;
+
+    // error is null on success
+    typedef std::function<void (std::exception_ptr error, Entity entity)>
+        EntityCallback;
+    typedef std::function<void (std::exception_ptr error)> DoneCallback;
+    // returns false to stop the scan
+    typedef std::function<bool (Entities& batch)> BatchCallback;
+
+    static void GetAsync(Id id, EntityCallback done)
+    {
+        RunAsync([id]() {
+            return Fetched(EntityRepository::Get(id));
+        }, std::move(done));
+    }
+
+    // done receives the saved copy of entity with id and version updated
+    static void SaveAsync(Entity entity, EntityCallback done)
+    {
+        RunAsync([entity]() mutable {
+            EntityRepository::Save(entity);
+            return Fetched(entity);
+        }, std::move(done));
+    }
+
+    static void DeleteAsync(Id id, DoneCallback done)
+    {
+        DbWorker& worker = DbWorker::instance();
+
+        worker.submit([id, done, &worker]() {
+            std::exception_ptr error;
+            try
+            {
+                EntityRepository::Delete(id);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+
+            worker.complete([done, error]() { done(error); });
+        });
+    }
+
+    /**
+     * Streams the table to onBatch in id order, batchSize entities at a
+     * time, then calls done. The next batch is only read after onBatch has
+     * returned, so a slow consumer does not make batches pile up in memory
+     * and the worker is free for other operations in between.
+     */
+    static void ScanAsync(size_t batchSize, BatchCallback onBatch,
+                          DoneCallback done)
+    {
+        ScanAfter(0, batchSize, std::move(onBatch), std::move(done));
+    }
+
+#ifdef DATAMAPPERCPP_HAS_COROUTINES
+    /**
+     * Awaitable that runs job on the worker. The awaiting coroutine is
+     * resumed through the completion executor.
+     */
+    template <typename T>
+    class Awaitable
+    {
+    public:
+        explicit Awaitable(std::function<T ()> job) :
+            _job(std::move(job)), _result(), _error()
+        { }
+
+        bool await_ready() const noexcept
+        { return false; }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            DbWorker& worker = DbWorker::instance();
+
+            worker.submit([this, handle, &worker]() {
+                try
+                {
+                    _result.run(_job);
+                }
+                catch (...)
+                {
+                    _error = std::current_exception();
+                }
+
+                worker.complete([handle]() { handle.resume(); });
+            });
+        }
+
+        T await_resume()
+        {
+            if (_error)
+                std::rethrow_exception(_error);
+            return _result.take();
+        }
+
+    private:
+        std::function<T ()> _job;
+        AwaitedResult<T> _result;
+        std::exception_ptr _error;
+    };
+
+    static Awaitable<Entity> GetAsync(Id id)
+    {
+        return Awaitable<Entity>([id]() {
+            return Fetched(EntityRepository::Get(id));
+        });
+    }
+
+    static Awaitable<Entity> SaveAsync(Entity entity)
+    {
+        return Awaitable<Entity>([entity]() mutable {
+            EntityRepository::Save(entity);
+            return Fetched(entity);
+        });
+    }
+
+    static Awaitable<void> DeleteAsync(Id id)
+    {
+        return Awaitable<void>([id]() {
+            EntityRepository::Delete(id);
+        });
+    }
+
+    /**
+     * Pages through the table in id order:
+     *
+     *   PersonAsync::Scan scan(100);
+     *   for (auto batch = co_await scan.next(); !batch.empty();
+     *        batch = co_await scan.next())
+     *       ...
+     */
+    class Scan
+    {
+    public:
+        explicit Scan(size_t batchSize) :
+            _batchSize(batchSize), _lastId(0), _exhausted(false)
+        { }
+
+        // Resumes with an empty batch after the last one.
+        Awaitable<Entities> next()
+        {
+            return Awaitable<Entities>([this]() {
+                Entities batch;
+                if (!_exhausted)
+                    EntityRepository::GetBatchAfter(_lastId, _batchSize,
+                                                    batch);
+                FetchAll(batch);
+
+                _exhausted = batch.size() < _batchSize;
+                if (!batch.empty())
+                    _lastId = batch.back().id;
+
+                return batch;
+            });
+        }
+
+    private:
+        size_t _batchSize;
+        Id _lastId;
+        bool _exhausted;
+    };
+#endif
+
+private:
+    AsyncRepository();
+
+    static Entity Fetched(Entity entity)
+    {
+        LazyFieldFetcher fetcher;
+        Mapping::accept(fetcher, entity);
+        return entity;
+    }
+
+    static void FetchAll(Entities& entities)
+    {
+        LazyFieldFetcher fetcher;
+        for (size_t i = 0; i < entities.size(); ++i)
+            Mapping::accept(fetcher, entities[i]);
+    }
+
+    template <typename Job>
+    static void RunAsync(Job job, EntityCallback done)
+    {
+        DbWorker& worker = DbWorker::instance();
+
+        worker.submit([job, done, &worker]() mutable {
+            std::exception_ptr error;
+            Entity entity;
+            try
+            {
+                entity = job();
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+
+            worker.complete([done, error, entity]() { done(error, entity); });
+        });
+    }
+
+    static void ScanAfter(Id afterId, size_t batchSize, BatchCallback onBatch,
+                          DoneCallback done)
+    {
+        DbWorker& worker = DbWorker::instance();
+
+        worker.submit([afterId, batchSize, onBatch, done, &worker]() {
+            // shared as the completion has to be copyable
+            std::shared_ptr<Entities> batch(new Entities);
+            std::exception_ptr error;
+            try
+            {
+                EntityRepository::GetBatchAfter(afterId, batchSize, *batch);
+                FetchAll(*batch);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+
+            worker.complete([batchSize, onBatch, done, batch, error]() {
+                if (error || batch->empty())
+                {
+                    done(error);
+                    return;
+                }
+
+                const Id lastId = batch->back().id;
+                const bool more = batch->size() == batchSize;
+
+                bool proceed = false;
+                try
+                {
+                    proceed = onBatch(*batch);
+                }
+                catch (...)
+                {
+                    done(std::current_exception());
+                    return;
+                }
+
+                if (proceed && more)
+                    ScanAfter(lastId, batchSize, onBatch, done);
+                else
+                    done(std::exception_ptr());
+            });
+        });
+    }
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_ASYNCREPOSITORY_H__ */
@@ -0,0 +1,389 @@
+#ifndef DATAMAPPERCPP_BINARYCODEC_H__
+#define DATAMAPPERCPP_BINARYCODEC_H__
+
+#include <datamappercpp/sql/exceptions.h>
+
+#include <datamappercpp/sql/detail/MappingTraits.h>
+
+#include <datamappercpp/Blob.h>
+#include <datamappercpp/Field.h>
+#include <datamappercpp/Lazy.h>
+#include <datamappercpp/Version.h>
+
+#include <utilcpp/disable_copy.h>
+
+#include <stdint.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace dm {
+namespace sql {
+
+/**
+ * Compact binary encoding of field values:
+ *
+ *   signed integers    zigzag varint, small magnitudes take one byte
+ *   unsigned integers  varint
+ *   bool               one byte
+ *   double             8 bytes, IEEE 754 bits in little-endian order
+ *   string, Blob       varint length followed by the bytes
+ *
+ * Varints are little-endian base 128, as in Protocol Buffers. Pointer
+ * fields, e.g. dm::Field<const char*>, cannot be encoded.
+ */
+class BinaryWriter
+{
+    UTILCPP_DISABLE_COPY(BinaryWriter)
+
+public:
+    BinaryWriter(std::string& out) :
+        _out(out)
+    { }
+
+    void putVarint(uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            _out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        _out.push_back(static_cast<char>(value));
+    }
+
+    void put(int64_t value)
+    {
+        putVarint((static_cast<uint64_t>(value) << 1)
+                  ^ static_cast<uint64_t>(value >> 63));
+    }
+
+    void put(int value)
+    { put(static_cast<int64_t>(value)); }
+
+    void put(uint32_t value)
+    { putVarint(value); }
+
+    void put(uint64_t value)
+    { putVarint(value); }
+
+    void put(bool value)
+    { _out.push_back(value ? 1 : 0); }
+
+    void put(double value)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        for (int i = 0; i < 8; ++i)
+            _out.push_back(static_cast<char>((bits >> (8 * i)) & 0xff));
+    }
+
+    void put(const std::string& value)
+    {
+        putVarint(value.size());
+        _out.append(value);
+    }
+
+    void put(const Blob& value)
+    {
+        putVarint(value.size());
+        if (!value.empty())
+            _out.append(reinterpret_cast<const char*>(&value[0]),
+                        value.size());
+    }
+
+private:
+    // Not defined, pointers such as const char* fields would otherwise
+    // convert to bool and be encoded as one byte.
+    template <typename T>
+    void put(const T* value);
+
+    std::string& _out;
+};
+
+/**
+ * Reads values written by BinaryWriter, throws CodecError on truncated or
+ * malformed input.
+ */
+class BinaryReader
+{
+    UTILCPP_DISABLE_COPY(BinaryReader)
+
+public:
+    BinaryReader(const char* data, size_t size) :
+        _position(reinterpret_cast<const unsigned char*>(data)),
+        _end(_position + size)
+    { }
+
+    bool atEnd() const
+    { return _position == _end; }
+
+    uint64_t getVarint()
+    {
+        uint64_t value = 0;
+
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            need(1);
+            const unsigned char byte = *_position++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+
+        throw CodecError("Varint is longer than 10 bytes");
+    }
+
+    void get(int64_t& value)
+    {
+        const uint64_t zigzag = getVarint();
+        value = static_cast<int64_t>(zigzag >> 1)
+                ^ -static_cast<int64_t>(zigzag & 1);
+    }
+
+    void get(int& value)
+    {
+        int64_t wide;
+        get(wide);
+        value = static_cast<int>(wide);
+    }
+
+    void get(uint32_t& value)
+    { value = static_cast<uint32_t>(getVarint()); }
+
+    void get(uint64_t& value)
+    { value = getVarint(); }
+
+    void get(bool& value)
+    {
+        need(1);
+        value = *_position++ != 0;
+    }
+
+    void get(double& value)
+    {
+        need(8);
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; ++i)
+            bits |= static_cast<uint64_t>(_position[i]) << (8 * i);
+        _position += 8;
+        std::memcpy(&value, &bits, sizeof(value));
+    }
+
+    void get(std::string& value)
+    {
+        const size_t size = getSize();
+        value.assign(reinterpret_cast<const char*>(_position), size);
+        _position += size;
+    }
+
+    void get(Blob& value)
+    {
+        const size_t size = getSize();
+        value.assign(_position, _position + size);
+        _position += size;
+    }
+
+    // Varint count or length that must not exceed the remaining input.
+    size_t getSize()
+    {
+        const uint64_t size = getVarint();
+        need(size);
+        return static_cast<size_t>(size);
+    }
+
+private:
+    void need(uint64_t bytes) const
+    {
+        if (bytes > static_cast<uint64_t>(_end - _position))
+            throw CodecError("Binary entity data is truncated");
+    }
+
+    const unsigned char* _position;
+    const unsigned char* _end;
+};
+
+class BinaryFieldWriter
+{
+    UTILCPP_DISABLE_COPY(BinaryFieldWriter)
+
+public:
+    BinaryFieldWriter(BinaryWriter& writer) :
+        _writer(writer)
+    { }
+
+    template <typename T>
+    void visitField(const Field<T>& , const T& value)
+    {
+        _writer.put(value);
+    }
+
+    // loads the value of lazy fields that were not loaded yet
+    template <typename T>
+    void visitField(const Field<Lazy<T> >& , const Lazy<T>& value)
+    {
+        _writer.put(value.get());
+    }
+
+    void visitField(const Field<Version>& , const Version& value)
+    {
+        _writer.put(value.value());
+    }
+
+private:
+    BinaryWriter& _writer;
+};
+
+class BinaryFieldReader
+{
+    UTILCPP_DISABLE_COPY(BinaryFieldReader)
+
+public:
+    BinaryFieldReader(BinaryReader& reader) :
+        _reader(reader)
+    { }
+
+    template <typename T>
+    void visitField(const Field<T>& , T& value)
+    {
+        _reader.get(value);
+    }
+
+    template <typename T>
+    void visitField(const Field<Lazy<T> >& , Lazy<T>& value)
+    {
+        T loaded;
+        _reader.get(loaded);
+        value.set(loaded);
+    }
+
+    void visitField(const Field<Version>& , Version& value)
+    {
+        int64_t version;
+        _reader.get(version);
+        value.set(version);
+    }
+
+private:
+    BinaryReader& _reader;
+};
+
+/**
+ * Encodes entities to and decodes them from a compact binary row format
+ * for caches, driven by Mapping::accept(). An entity is its id followed by
+ * its fields in mapping order, see BinaryWriter. A collection is the
+ * number of entities followed by the entities. Encodings start with a
+ * format version byte.
+ *
+ * Field names and types are not stored, data must be decoded with the
+ * mapping it was encoded with.
+ */
+template <class Entity, class Mapping>
+class BinaryCodec
+{
+public:
+    typedef std::vector<Entity> Entities;
+
+    enum { FORMAT_VERSION = 1 };
+
+    // Appends the encoding of the entity to out.
+    static void Encode(const Entity& entity, std::string& out)
+    {
+        BinaryWriter writer(out);
+        writer.putVarint(FORMAT_VERSION);
+        Write(writer, entity);
+    }
+
+    static void Encode(const Entities& entities, std::string& out)
+    {
+        BinaryWriter writer(out);
+        writer.putVarint(FORMAT_VERSION);
+        writer.putVarint(entities.size());
+        for (size_t i = 0; i < entities.size(); ++i)
+            Write(writer, entities[i]);
+    }
+
+    static std::string Encode(const Entity& entity)
+    {
+        std::string out;
+        Encode(entity, out);
+        return out;
+    }
+
+    static std::string Encode(const Entities& entities)
+    {
+        std::string out;
+        Encode(entities, out);
+        return out;
+    }
+
+    static Entity Decode(const std::string& data)
+    {
+        BinaryReader reader(data.data(), data.size());
+        CheckVersion(reader);
+
+        Entity entity;
+        Read(reader, entity);
+        CheckEnd(reader);
+
+        return entity;
+    }
+
+    // Appends the decoded entities to entities.
+    static void Decode(const std::string& data, Entities& entities)
+    {
+        BinaryReader reader(data.data(), data.size());
+        CheckVersion(reader);
+
+        // every entity takes at least one byte, guards the reserve()
+        const size_t count = reader.getSize();
+        entities.reserve(entities.size() + count);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            entities.resize(entities.size() + 1);
+            Read(reader, entities.back());
+        }
+        CheckEnd(reader);
+    }
+
+private:
+    typedef typename IdTypeOf<Mapping>::type Id;
+
+    BinaryCodec();
+
+    static void Write(BinaryWriter& writer, const Entity& entity)
+    {
+        writer.put(static_cast<int64_t>(entity.id));
+
+        // accept() takes a non-const entity, the writer does not modify it
+        BinaryFieldWriter fieldWriter(writer);
+        Mapping::accept(fieldWriter, const_cast<Entity&>(entity));
+    }
+
+    static void Read(BinaryReader& reader, Entity& entity)
+    {
+        int64_t id;
+        reader.get(id);
+        entity.id = static_cast<Id>(id);
+
+        BinaryFieldReader fieldReader(reader);
+        Mapping::accept(fieldReader, entity);
+    }
+
+    static void CheckVersion(BinaryReader& reader)
+    {
+        if (reader.getVarint() != FORMAT_VERSION)
+            throw CodecError("Unsupported binary entity format version");
+    }
+
+    static void CheckEnd(const BinaryReader& reader)
+    {
+        if (!reader.atEnd())
+            throw CodecError("Trailing bytes after binary entity data");
+    }
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_BINARYCODEC_H__ */
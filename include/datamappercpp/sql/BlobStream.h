@@ -0,0 +1,115 @@
+#ifndef DATAMAPPERCPP_BLOBSTREAM_H__
+#define DATAMAPPERCPP_BLOBSTREAM_H__
+
+#include <datamappercpp/sql/db.h>
+#include <datamappercpp/sql/exceptions.h>
+
+#include <datamappercpp/sql/detail/Backend.h>
+#include <datamappercpp/sql/detail/ValueCodec.h>
+#include <datamappercpp/sql/detail/stdutil.h>
+
+#include <datamappercpp/Blob.h>
+
+#include <dbccpp/dbccpp.h>
+
+#include <utilcpp/disable_copy.h>
+
+#include <string>
+
+namespace dm {
+namespace sql {
+
+/**
+ * Incremental I/O on a single BLOB value, so that large payloads can be
+ * read and written in chunks instead of being held in memory as a whole.
+ *
+ * The size of a blob cannot be changed through the stream, allocate it
+ * with Repository::AllocateBlob() first:
+ *
+ *   FileRepository::AllocateBlob(id, "contents", total);
+ *   BlobStream stream(FileMapping::getLabel(), "contents", id, true);
+ *   stream.write(chunk, chunkSize, offset);
+ *
+ * schema selects an attached database, e.g. the ReadReplica.
+ */
+class BlobStream
+{
+    UTILCPP_DISABLE_COPY(BlobStream)
+
+public:
+    BlobStream(const std::string& table, const std::string& column,
+               int64_t id, bool writable = false,
+               const std::string& schema = "main") :
+        _blob(Backend::instance().openBlob(schema, table, column, id,
+                                           writable))
+    { }
+
+    /**
+     * Reads the whole blob of the row into blob. A NULL value, which
+     * incremental I/O cannot open, is read as an empty blob.
+     */
+    static void Read(const std::string& table, const std::string& column,
+                     int64_t id, Blob& blob,
+                     const std::string& schema = "main")
+    {
+        try
+        {
+            BlobStream(table, column, id, false, schema).read(blob);
+        }
+        catch (const BlobError&)
+        {
+            if (!IsNull(table, column, id, schema))
+                throw;
+            blob.clear();
+        }
+    }
+
+    size_t size() const
+    { return _blob->size(); }
+
+    void read(void* buffer, size_t size, size_t offset = 0) const
+    { _blob->read(buffer, size, offset); }
+
+    void read(Blob& blob) const
+    {
+        blob.resize(size());
+        if (!blob.empty())
+            read(&blob[0], blob.size());
+    }
+
+    void write(const void* data, size_t size, size_t offset = 0)
+    { _blob->write(data, size, offset); }
+
+    void write(const BlobSpan& span, size_t offset = 0)
+    {
+        if (span.size > 0)
+            write(span.data, span.size, offset);
+    }
+
+private:
+    static bool IsNull(const std::string& table, const std::string& column,
+                       int64_t id, const std::string& schema)
+    {
+        try
+        {
+            Statement statement = PrepareStatement("SELECT " + column
+                    + " IS NULL FROM " + schema + "." + table
+                    + " WHERE id=?");
+            ValueCodec<int64_t>::bind(statement, id);
+
+            dbc::ResultSet::ptr result(statement->executeQuery());
+            return result->next() && result->getInt(0) != 0;
+        }
+        catch (const dbc::DbErrorBase&)
+        {
+            // the BlobError of opening the blob is more telling
+            return false;
+        }
+    }
+
+    const stdutil::shared_ptr<BlobHandle> _blob;
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_BLOBSTREAM_H__ */
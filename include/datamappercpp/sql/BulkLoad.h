@@ -0,0 +1,214 @@
+#ifndef DATAMAPPERCPP_BULKLOAD_H__
+#define DATAMAPPERCPP_BULKLOAD_H__
+
+#include <datamappercpp/sql/Repository.h>
+#include <datamappercpp/sql/Transaction.h>
+#include <datamappercpp/sql/db.h>
+#include <datamappercpp/sql/exceptions.h>
+
+#include <dbccpp/dbccpp.h>
+
+#include <utilcpp/disable_copy.h>
+
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace dm {
+namespace sql {
+
+/**
+ * Session for loading many entities into a table at once.
+ *
+ * While the session is open the non-unique explicit indexes of the table,
+ * both declared ones and those created in customCreateStatements(), are
+ * dropped, and the connection does not wait for writes to reach the disk
+ * (PRAGMA synchronous=OFF). Entities are inserted in transactions of
+ * batchRows entities. finish(), or the destructor if finish() was not
+ * reached, recreates the indexes, runs ANALYZE on the table and restores
+ * the connection settings.
+ *
+ *   {
+ *       dm::sql::BulkLoad<Person, PersonMapping> load;
+ *       PersonRepository::DeleteAll();
+ *       load.insert(people);
+ *       load.finish();
+ *   }
+ *
+ * Unique indexes, including those of UNIQUE and PRIMARY KEY constraints,
+ * are kept and maintained during the load, so inserting a duplicate fails
+ * as it would outside the session. If recreating an index fails, finish()
+ * throws BulkLoadError and can be called again once the cause has been
+ * fixed. A crash during the load may leave the
+ * database corrupt, as with any synchronous=OFF write.
+ */
+template <class Entity, class Mapping>
+class BulkLoad
+{
+    UTILCPP_DISABLE_COPY(BulkLoad)
+
+public:
+    typedef Repository<Entity, Mapping> EntityRepository;
+    typedef typename EntityRepository::Entities Entities;
+
+    BulkLoad(size_t batchRows = 10000) :
+        _batchRows(std::max<size_t>(1, batchRows)),
+        _indexStatements(),
+        _synchronous(PragmaValue("synchronous")),
+        _finished(false)
+    {
+        ExecuteStatement("PRAGMA synchronous=OFF");
+
+        try
+        {
+            DropIndexes();
+        }
+        catch (...)
+        {
+            Restore();
+            throw;
+        }
+    }
+
+    /**
+     * Inserts the entities and sets their ids, committing every batchRows
+     * entities. Entities with ids are updated, as with Repository::Save().
+     */
+    void insert(Entities& entities)
+    {
+        for (size_t first = 0; first < entities.size(); first += _batchRows)
+        {
+            const size_t last = std::min(entities.size(), first + _batchRows);
+
+            Transaction transaction;
+            for (size_t i = first; i < last; ++i)
+                EntityRepository::Save(entities[i], false);
+            transaction.commit();
+        }
+    }
+
+    void finish()
+    {
+        if (_finished)
+            return;
+
+        Restore();
+        _finished = true;
+    }
+
+    // Never throws, call finish() to get errors.
+    ~BulkLoad()
+    {
+        if (_finished)
+            return;
+
+        try
+        {
+            Restore();
+        }
+        catch (...)
+        { }
+    }
+
+private:
+    // Drops the non-unique indexes that have SQL, constraint indexes have
+    // none.
+    void DropIndexes()
+    {
+        std::vector<std::string> names;
+
+        {
+            Statement statement = PrepareStatement("SELECT name,sql FROM "
+                    "sqlite_master WHERE type='index' AND tbl_name=? "
+                    "AND sql IS NOT NULL");
+            *statement << Mapping::getLabel();
+
+            dbc::ResultSet::ptr result(statement->executeQuery());
+            while (result->next())
+            {
+                const std::string sql = result->get<std::string>(1);
+                if (IsUnique(sql))
+                    continue;
+                names.push_back(result->get<std::string>(0));
+                _indexStatements.push_back(sql);
+            }
+        }
+
+        for (size_t i = 0; i < names.size(); ++i)
+            ExecuteStatement("DROP INDEX " + names[i]);
+    }
+
+    // Recreates the indexes and restores the settings even if one of the
+    // steps fails, the first error is reported as BulkLoadError. Indexes
+    // that could not be recreated are kept for the next attempt.
+    void Restore()
+    {
+        std::string error;
+        std::vector<std::string> failed;
+
+        for (size_t i = 0; i < _indexStatements.size(); ++i)
+            if (!Attempt(_indexStatements[i], error))
+                failed.push_back(_indexStatements[i]);
+        _indexStatements.swap(failed);
+
+        Attempt("ANALYZE " + Mapping::getLabel(), error);
+
+        std::ostringstream synchronous;
+        synchronous << "PRAGMA synchronous=" << _synchronous;
+        Attempt(synchronous.str(), error);
+
+        if (!error.empty())
+            throw BulkLoadError("Restoring " + Mapping::getLabel()
+                    + " after bulk load failed: " + error);
+    }
+
+    static bool Attempt(const std::string& sql, std::string& error)
+    {
+        try
+        {
+            ExecuteStatement(sql);
+            return true;
+        }
+        catch (const std::exception& e)
+        {
+            if (error.empty())
+                error = e.what();
+            return false;
+        }
+    }
+
+    static bool IsUnique(const std::string& sql)
+    {
+        std::istringstream words(sql);
+        std::string create, unique;
+        words >> create >> unique;
+        return ToUpper(unique) == "UNIQUE";
+    }
+
+    static std::string ToUpper(std::string s)
+    {
+        for (size_t i = 0; i < s.size(); ++i)
+            s[i] = static_cast<char>(std::toupper(
+                        static_cast<unsigned char>(s[i])));
+        return s;
+    }
+
+    static int PragmaValue(const std::string& pragma)
+    {
+        Statement statement = PrepareStatement("PRAGMA " + pragma);
+        dbc::ResultSet::ptr result(statement->executeQuery());
+        result->next();
+        return result->get<int>(0);
+    }
+
+    size_t _batchRows;
+    std::vector<std::string> _indexStatements;
+    int _synchronous;
+    bool _finished;
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_BULKLOAD_H__ */
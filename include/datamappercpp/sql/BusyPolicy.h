@@ -0,0 +1,297 @@
+#ifndef DATAMAPPERCPP_BUSYPOLICY_H__
+#define DATAMAPPERCPP_BUSYPOLICY_H__
+
+#include <datamappercpp/sql/SqliteBackend.h>
+#include <datamappercpp/sql/Transaction.h>
+#include <datamappercpp/sql/db.h>
+
+#include <datamappercpp/sql/detail/Sleep.h>
+#include <datamappercpp/sql/detail/Stopwatch.h>
+
+#include <dbccpp/dbccpp.h>
+
+#include <stdint.h>
+
+#include <algorithm>
+
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || (__cplusplus > 199711L)
+  #include <mutex>
+#endif
+
+namespace dm {
+namespace sql {
+
+/**
+ * How RunInTransaction() retries transactions that failed because the
+ * database was locked: up to maxRetries times, after a randomized delay
+ * that doubles with each retry from initialBackoffMilliseconds up to
+ * maxBackoffMilliseconds.
+ */
+struct BusyPolicy
+{
+    int maxRetries;
+    int initialBackoffMilliseconds;
+    int maxBackoffMilliseconds;
+
+    BusyPolicy(int retries = 5, int initialBackoff = 10,
+               int maxBackoff = 1000) :
+        maxRetries(retries),
+        initialBackoffMilliseconds(initialBackoff),
+        maxBackoffMilliseconds(maxBackoff)
+    { }
+
+    // Half of the delay is fixed, half random, so that writers that
+    // collided once do not collide again on every retry.
+    int backoffMilliseconds(int retry, double random) const
+    {
+        double delay = initialBackoffMilliseconds;
+        for (int i = 0; i < retry && delay < maxBackoffMilliseconds; ++i)
+            delay *= 2;
+        delay = std::min<double>(delay, maxBackoffMilliseconds);
+
+        return static_cast<int>(delay / 2 + random * delay / 2);
+    }
+};
+
+struct BusyStatistics
+{
+    // transactions restarted after SQLITE_BUSY
+    size_t retries;
+    // transactions that were still busy after the last retry
+    size_t failures;
+    // backoff before the retries
+    double secondsWaited;
+    // statements waiting for locks within the busy timeout
+    size_t busyWaits;
+    double secondsBusyWaiting;
+
+    BusyStatistics() :
+        retries(0), failures(0), secondsWaited(0.0),
+        busyWaits(0), secondsBusyWaiting(0.0)
+    { }
+};
+
+/**
+ * Busy statistics and backoff randomness, shared by the threads that use
+ * the connection, e.g. the AsyncRepository worker.
+ */
+class BusyCounters
+{
+public:
+    static BusyStatistics statistics()
+    {
+        Lock lock;
+        return state().statistics;
+    }
+
+    static void reset()
+    {
+        Lock lock;
+        state().statistics = BusyStatistics();
+    }
+
+    static void addRetry(double seconds)
+    {
+        Lock lock;
+        ++state().statistics.retries;
+        state().statistics.secondsWaited += seconds;
+    }
+
+    static void addFailure()
+    {
+        Lock lock;
+        ++state().statistics.failures;
+    }
+
+    static void addBusyWait(double seconds)
+    {
+        Lock lock;
+        ++state().statistics.busyWaits;
+        state().statistics.secondsBusyWaiting += seconds;
+    }
+
+    // xorshift, std::rand() state belongs to the application
+    static double random()
+    {
+        Lock lock;
+        uint32_t& x = state().random;
+        if (x == 0)
+            x = static_cast<uint32_t>(Stopwatch::now() * 1e6) | 1;
+
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+
+        return x / 4294967296.0;
+    }
+
+    static void setTimeout(int milliseconds)
+    {
+        Lock lock;
+        state().timeoutMilliseconds = milliseconds;
+    }
+
+    static int timeout()
+    {
+        Lock lock;
+        return state().timeoutMilliseconds;
+    }
+
+    /**
+     * SQLite busy handler that waits like PRAGMA busy_timeout does and
+     * counts the waits, which busy_timeout would hide.
+     */
+    static int busyHandler(void* , int count)
+    {
+        static const int delays[] =
+            { 1, 2, 5, 10, 15, 20, 25, 25, 25, 50, 50, 100 };
+        static const int last = sizeof(delays) / sizeof(delays[0]) - 1;
+
+        int waited = 0;
+        for (int i = 0; i < count; ++i)
+            waited += delays[std::min(i, last)];
+
+        const int remaining = timeout() - waited;
+        if (remaining <= 0)
+            return 0;
+
+        Stopwatch stopwatch;
+        SleepMilliseconds(std::min(delays[std::min(count, last)],
+                                   remaining));
+        addBusyWait(stopwatch.elapsedSeconds());
+
+        return 1;
+    }
+
+private:
+    struct State
+    {
+        BusyStatistics statistics;
+        uint32_t random;
+        int timeoutMilliseconds;
+
+        State() :
+            statistics(), random(0), timeoutMilliseconds(0)
+        { }
+    };
+
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || (__cplusplus > 199711L)
+    class Lock
+    {
+    public:
+        Lock() :
+            _lock(mutex())
+        { }
+
+    private:
+        static std::mutex& mutex()
+        {
+            static std::mutex m;
+            return m;
+        }
+
+        std::lock_guard<std::mutex> _lock;
+    };
+#else
+    // there is no worker thread without C++11
+    class Lock
+    {
+    public:
+        Lock()
+        { }
+    };
+#endif
+
+    BusyCounters();
+
+    static State& state()
+    {
+        static State s;
+        return s;
+    }
+};
+
+/**
+ * Makes SQLite wait up to the given time for other connections to release
+ * their locks before a statement fails with SQLITE_BUSY. The waits are
+ * counted in BusyStatistics.
+ */
+void SetBusyTimeout(int milliseconds)
+{
+    BusyCounters::setTimeout(std::max(0, milliseconds));
+    sqlite3_busy_handler(SqliteHandle::get(),
+            milliseconds > 0 ? &BusyCounters::busyHandler : 0, 0);
+}
+
+BusyStatistics GetBusyStatistics()
+{
+    return BusyCounters::statistics();
+}
+
+void ResetBusyStatistics()
+{
+    BusyCounters::reset();
+}
+
+/**
+ * Calls callable in a transaction and commits it. If a statement, BEGIN
+ * or COMMIT fails because another connection holds a lock, the transaction
+ * is rolled back and the whole callable is run again according to policy.
+ * Other errors and the last busy error are propagated.
+ *
+ * callable is run once per attempt, so it must not have effects outside
+ * the database that cannot be repeated. Repository calls in callable must pass
+ * enableTransaction = false, otherwise they throw NestedTransactionError,
+ * as does RunInTransaction() itself inside another transaction.
+ */
+template <typename Callable>
+void RunInTransaction(Callable callable,
+                      const BusyPolicy& policy = BusyPolicy())
+{
+    for (int retry = 0; ; ++retry)
+    {
+        bool busy = false;
+
+        try
+        {
+            Transaction transaction;
+
+            try
+            {
+                callable();
+                transaction.commit();
+                return;
+            }
+            catch (const dbc::DbErrorBase& )
+            {
+                // check before the rollback resets the error code
+                busy = SqliteHandle::isBusy();
+                throw;
+            }
+        }
+        catch (const dbc::DbErrorBase& )
+        {
+            // BEGIN failed, nothing was rolled back
+            busy = busy || SqliteHandle::isBusy();
+
+            if (!busy)
+                throw;
+
+            if (retry >= policy.maxRetries)
+            {
+                BusyCounters::addFailure();
+                throw;
+            }
+        }
+
+        Stopwatch stopwatch;
+        SleepMilliseconds(policy.backoffMilliseconds(retry,
+                    BusyCounters::random()));
+
+        BusyCounters::addRetry(stopwatch.elapsedSeconds());
+    }
+}
+
+} }
+
+#endif /* DATAMAPPERCPP_BUSYPOLICY_H__ */
@@ -0,0 +1,303 @@
+#ifndef DATAMAPPERCPP_CHANGEFEED_H__
+#define DATAMAPPERCPP_CHANGEFEED_H__
+
+#include <datamappercpp/sql/db.h>
+
+#include <datamappercpp/sql/detail/Backend.h>
+#include <datamappercpp/sql/detail/ValueCodec.h>
+#include <datamappercpp/sql/detail/stdutil.h>
+
+#include <dbccpp/dbccpp.h>
+
+#include <stdint.h>
+
+#include <exception>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace dm {
+namespace sql {
+
+enum ChangeOperation
+{
+    CHANGE_INSERT = 1,
+    CHANGE_UPDATE = 2,
+    CHANGE_DELETE = 3,
+    // id is 0, all rows of the table were deleted
+    CHANGE_DELETE_ALL = 4
+};
+
+struct Change
+{
+    std::string table;
+    int64_t id;
+    ChangeOperation operation;
+    // position in the change log, 0 when the log is disabled
+    int64_t sequence;
+
+    Change() :
+        table(), id(0), operation(CHANGE_INSERT), sequence(0)
+    { }
+
+    Change(const std::string& t, int64_t i, ChangeOperation o) :
+        table(t), id(i), operation(o), sequence(0)
+    { }
+};
+
+typedef std::vector<Change> Changes;
+
+/**
+ * Feed of the rows that Repository inserts, updates and deletes.
+ *
+ * Changes are delivered to subscribers in a batch per transaction, after
+ * the Transaction commits, and are dropped when it is rolled back, also by
+ * a ROLLBACK outside Transaction or by SQLite after an error. Changes
+ * outside transactions are delivered right away.
+ *
+ * The changes are committed when subscribers run, so their exceptions are
+ * not thrown from the Save() or Transaction that made the changes, as
+ * callers would retry and write them twice. The batch is still delivered
+ * to the other subscribers and each exception is passed to the error
+ * handler, see setErrorHandler(), or ignored if there is none.
+ *
+ * The change log optionally keeps the changes in the dm_change_log table,
+ * written in the same transaction as the changes themselves, for
+ * consumers that must not miss changes made while they were not running.
+ *
+ * Repositories only collect changes while there are subscribers or the
+ * change log is enabled.
+ *
+ * Subscribers run on the thread that made the changes, e.g. the DbWorker
+ * thread for AsyncRepository saves. Subscribing and unsubscribing are safe
+ * from any thread, a subscriber that is removed during a delivery may
+ * still receive that batch.
+ */
+class ChangeFeed
+{
+public:
+    typedef stdutil::function<void (const Changes&)> Subscriber;
+    // Receives the what() of a subscriber exception and the batch that
+    // the subscriber failed to process.
+    typedef stdutil::function<void (const std::string&, const Changes&)>
+        ErrorHandler;
+
+    // Returns the handle for unsubscribe().
+    static int subscribe(Subscriber subscriber)
+    {
+        State& s = state();
+        Lock lock(s.mutex);
+        s.subscribers[++s.lastHandle] = subscriber;
+        return s.lastHandle;
+    }
+
+    static void unsubscribe(int handle)
+    {
+        State& s = state();
+        Lock lock(s.mutex);
+        s.subscribers.erase(handle);
+    }
+
+    // An empty handler ignores subscriber exceptions.
+    static void setErrorHandler(ErrorHandler handler)
+    {
+        State& s = state();
+        Lock lock(s.mutex);
+        s.errorHandler = handler;
+    }
+
+    static void enableChangeLog(bool enabled)
+    {
+        State& s = state();
+        Lock lock(s.mutex);
+
+        if (enabled)
+            ExecuteStatement("CREATE TABLE IF NOT EXISTS " + logTable()
+                    + " (seq INTEGER PRIMARY KEY AUTOINCREMENT,"
+                      "table_name TEXT NOT NULL,"
+                      "entity_id INTEGER NOT NULL,"
+                      "operation INTEGER NOT NULL)");
+
+        s.logEnabled = enabled;
+        s.logInsert.reset();
+    }
+
+    // Appends at most limit logged changes after sequence to changes.
+    static void readLog(int64_t afterSequence, size_t limit, Changes& changes)
+    {
+        Statement statement = PrepareStatement("SELECT seq,table_name,"
+                "entity_id,operation FROM " + logTable()
+                + " WHERE seq>? ORDER BY seq LIMIT ?");
+        ValueCodec<int64_t>::bind(statement, afterSequence);
+        ValueCodec<int64_t>::bind(statement, static_cast<int64_t>(limit));
+
+        dbc::ResultSet::ptr result(statement->executeQuery());
+        while (result->next())
+        {
+            Change change(result->get<std::string>(1),
+                          ValueCodec<int64_t>::read(*result, 2),
+                          static_cast<ChangeOperation>(result->get<int>(3)));
+            change.sequence = ValueCodec<int64_t>::read(*result, 0);
+            changes.push_back(change);
+        }
+    }
+
+    // Deletes logged changes up to and including sequence, once all
+    // consumers have seen them.
+    static void truncateLog(int64_t sequence)
+    {
+        Statement statement = PrepareStatement("DELETE FROM " + logTable()
+                + " WHERE seq<=?");
+        ValueCodec<int64_t>::bind(statement, sequence);
+        statement->executeUpdate();
+    }
+
+    static std::string logTable()
+    {
+        return "dm_change_log";
+    }
+
+    static bool active()
+    {
+        State& s = state();
+        Lock lock(s.mutex);
+        return s.logEnabled || !s.subscribers.empty();
+    }
+
+    /**
+     * Called by Repository after a change was made, before the
+     * transaction that made it commits.
+     */
+    static void record(const std::string& table, int64_t id,
+                       ChangeOperation operation)
+    {
+        State& s = state();
+        Lock lock(s.mutex);
+        if (!s.logEnabled && s.subscribers.empty())
+            return;
+
+        Change change(table, id, operation);
+
+        if (s.logEnabled)
+        {
+            if (!s.logInsert)
+                s.logInsert = PrepareStatement("INSERT INTO " + logTable()
+                        + " (table_name,entity_id,operation) VALUES (?,?,?)");
+            else
+            {
+                s.logInsert->reset();
+                s.logInsert->clear();
+            }
+
+            *s.logInsert << table;
+            ValueCodec<int64_t>::bind(s.logInsert, id);
+            *s.logInsert << static_cast<int>(operation);
+            s.logInsert->executeUpdate();
+
+            change.sequence = Backend::instance().lastInsertId();
+        }
+
+        if (!s.subscribers.empty())
+        {
+            Backend::instance().addRollbackListener(&ChangeFeed::discard);
+            s.pending.push_back(change);
+        }
+    }
+
+    /**
+     * Delivers the recorded changes unless a transaction is still open.
+     * Called by Transaction after commit and by Repository after changes.
+     * Does not throw subscriber exceptions, see setErrorHandler().
+     */
+    static void publish()
+    {
+        State& s = state();
+        Changes changes;
+        Subscribers subscribers;
+        ErrorHandler errorHandler;
+        {
+            Lock lock(s.mutex);
+            if (s.pending.empty() || Backend::instance().inTransaction())
+                return;
+
+            changes.swap(s.pending);
+            // delivered without the lock, subscribers may unsubscribe
+            subscribers = s.subscribers;
+            errorHandler = s.errorHandler;
+        }
+        for (Subscribers::const_iterator it = subscribers.begin();
+             it != subscribers.end(); ++it)
+        {
+            try
+            {
+                it->second(changes);
+            }
+            catch (const std::exception& e)
+            {
+                reportError(errorHandler, e.what(), changes);
+            }
+            catch (...)
+            {
+                reportError(errorHandler, "Unknown exception", changes);
+            }
+        }
+    }
+
+    // Called by Transaction and the SQLite rollback hook after rollback.
+    static void discard()
+    {
+        State& s = state();
+        Lock lock(s.mutex);
+        s.pending.clear();
+    }
+
+private:
+    typedef std::map<int, Subscriber> Subscribers;
+    // recursive as statements run under the lock and a rollback they
+    // cause calls discard()
+    typedef stdutil::lock_guard<stdutil::recursive_mutex> Lock;
+
+    struct State
+    {
+        Subscribers subscribers;
+        int lastHandle;
+        bool logEnabled;
+        Statement logInsert;
+        Changes pending;
+        ErrorHandler errorHandler;
+        stdutil::recursive_mutex mutex;
+
+        State() :
+            subscribers(), lastHandle(0), logEnabled(false), logInsert(),
+            pending(), errorHandler(), mutex()
+        { }
+    };
+
+    ChangeFeed();
+
+    // A throwing handler must not keep the batch from the other
+    // subscribers either.
+    static void reportError(const ErrorHandler& handler,
+                            const std::string& error, const Changes& changes)
+    {
+        if (!handler)
+            return;
+
+        try
+        {
+            handler(error, changes);
+        }
+        catch (...)
+        { }
+    }
+
+    static State& state()
+    {
+        static State s;
+        return s;
+    }
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_CHANGEFEED_H__ */
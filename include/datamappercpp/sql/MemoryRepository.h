@@ -0,0 +1,459 @@
+#ifndef DATAMAPPERCPP_MEMORYREPOSITORY_H__
+#define DATAMAPPERCPP_MEMORYREPOSITORY_H__
+
+#include <datamappercpp/sql/exceptions.h>
+
+#include <datamappercpp/sql/detail/MappingTraits.h>
+#include <datamappercpp/sql/detail/MemoryIndex.h>
+#include <datamappercpp/sql/detail/StatementBuilderFieldVisitors.h>
+#include <datamappercpp/sql/detail/stdutil.h>
+
+#include <datamappercpp/Version.h>
+
+#include <utilcpp/disable_copy.h>
+
+#include <stdint.h>
+
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace dm {
+namespace sql {
+
+/**
+ * Transaction over memory repositories. Changes made while it is open are
+ * undone when it is rolled back or destroyed without commit.
+ *
+ * A transaction opened while another one is open joins the outer one, so
+ * MemoryRepository operations can open their own transactions inside
+ * a caller's.
+ */
+class MemoryTransaction
+{
+    UTILCPP_DISABLE_COPY(MemoryTransaction)
+
+public:
+    typedef stdutil::function<void ()> Undo;
+
+    MemoryTransaction(bool enabled = true) :
+        _is_owner(enabled && !log().active),
+        _is_completed(false)
+    {
+        if (_is_owner)
+            log().active = true;
+    }
+
+    void commit()
+    {
+        if (_is_owner && !_is_completed)
+        {
+            log().undos.clear();
+            log().outcome.reset();
+            log().active = false;
+            _is_completed = true;
+        }
+    }
+
+    void rollback()
+    {
+        if (_is_owner && !_is_completed)
+        {
+            Log& l = log();
+            while (!l.undos.empty())
+            {
+                l.undos.back()();
+                l.undos.pop_back();
+            }
+            if (l.outcome)
+                l.outcome->rolledBack = true;
+            l.outcome.reset();
+            l.active = false;
+            _is_completed = true;
+        }
+    }
+
+    ~MemoryTransaction()
+    {
+        rollback();
+    }
+
+    // Called by MemoryRepository before each change.
+    static void recordUndo(const Undo& undo)
+    {
+        Log& l = log();
+        if (l.active)
+            l.undos.push_back(undo);
+    }
+
+    static bool active()
+    {
+        return log().active;
+    }
+
+    // Outcome of the open transaction for the versions that it changes.
+    static const TransactionOutcomePtr& outcome()
+    {
+        Log& l = log();
+        if (!l.outcome)
+            l.outcome.reset(new TransactionOutcome());
+        return l.outcome;
+    }
+
+private:
+    struct Log
+    {
+        bool active;
+        std::vector<Undo> undos;
+        TransactionOutcomePtr outcome;
+
+        Log() :
+            active(false), undos(), outcome()
+        { }
+    };
+
+    static Log& log()
+    {
+        static Log l;
+        return l;
+    }
+
+    bool _is_owner;
+    bool _is_completed;
+};
+
+/**
+ * Repository of entities that are only kept in memory, in a hash table by
+ * id with optional hash and sorted indexes over fields. Fields without an
+ * index are searched by scanning all entities.
+ *
+ * It has the same static interface as Repository for saving, deleting and
+ * looking up entities by id, field and range, so code that takes the
+ * repository as a template parameter can run against either, e.g. tests
+ * without a database or caches. SQL-specific operations are not available.
+ * Operations are atomic, multiple operations are grouped with
+ * MemoryTransaction.
+ */
+template <class Entity, class Mapping>
+class MemoryRepository
+{
+public:
+    typedef std::vector<Entity> Entities;
+    typedef typename IdTypeOf<Mapping>::type Id;
+
+    // for interface compatibility with Repository
+    static void CreateTable(bool = true)
+    { }
+
+    static void Save(Entities& entities, bool enableTransaction = true)
+    {
+        MemoryTransaction transaction(enableTransaction);
+
+        for (size_t i = 0; i < entities.size(); ++i)
+            Save(entities[i], false);
+
+        transaction.commit();
+    }
+
+    static void Save(Entity& entity, bool enableTransaction = true)
+    {
+        // changes made in a caller's transaction may still be rolled back
+        const bool enclosed = MemoryTransaction::active();
+
+        MemoryTransaction transaction(enableTransaction);
+        Store& s = store();
+
+        VersionFieldFinder versionFinder;
+        Mapping::accept(versionFinder, entity);
+
+        const bool update = entity.id > 0;
+        if (update)
+        {
+            const Entity* stored = s.entities.get(entity.id);
+            if (!stored)
+            {
+                std::ostringstream msg;
+                msg << "0 rows affected while saving single entity "
+                    << "instead of 1";
+                if (versionFinder.found())
+                    throw ConcurrentModificationError(msg.str());
+                throw NotOneError(msg.str());
+            }
+
+            if (versionFinder.found()
+                    && VersionOf(*stored) != versionFinder.version().value())
+            {
+                std::ostringstream msg;
+                msg << Mapping::getLabel() << " with ID " << entity.id
+                    << " and version " << versionFinder.version().value()
+                    << " was changed or deleted concurrently";
+                throw ConcurrentModificationError(msg.str());
+            }
+
+            MemoryTransaction::recordUndo(Restore(*stored));
+        }
+        else
+        {
+            entity.id = ++s.lastId;
+            MemoryTransaction::recordUndo(Remove(entity.id));
+        }
+
+        if (versionFinder.found())
+        {
+            const int64_t version = update ?
+                versionFinder.version().value() + 1 : 1;
+
+            if (enclosed)
+                versionFinder.version().set(version,
+                        MemoryTransaction::outcome());
+            else
+                versionFinder.version().set(version);
+        }
+
+        s.entities.put(entity);
+
+        transaction.commit();
+    }
+
+    static void Delete(Entity& entity,
+                bool enableTransaction = true,
+                bool checkOneDeleted = true)
+    {
+        if (entity.id < 1)
+            throw std::invalid_argument("Entity ID is less than 1");
+
+        Delete(entity.id, enableTransaction, checkOneDeleted);
+
+        entity.id = -1;
+    }
+
+    static void Delete(Id id,
+                bool enableTransaction = true,
+                bool checkOneDeleted = true)
+    {
+        MemoryTransaction transaction(enableTransaction);
+        Store& s = store();
+
+        const Entity* stored = s.entities.get(id);
+        if (!stored)
+        {
+            if (checkOneDeleted)
+                throw NotOneError("0 rows affected while deleting single "
+                                  "entity instead of 1");
+            return;
+        }
+
+        MemoryTransaction::recordUndo(Restore(*stored));
+        s.entities.remove(id);
+
+        transaction.commit();
+    }
+
+    static void DeleteAll(bool enableTransaction = true)
+    {
+        MemoryTransaction transaction(enableTransaction);
+        Store& s = store();
+
+        Entities all;
+        s.entities.all(all);
+        MemoryTransaction::recordUndo(RestoreAll(all));
+
+        s.entities.clear();
+
+        transaction.commit();
+    }
+
+    static Entity Get(Id id)
+    {
+        if (id < 1)
+            throw std::invalid_argument("ID is less than 1");
+
+        const Entity* stored = store().entities.get(id);
+        if (!stored)
+        {
+            std::ostringstream msg;
+            msg << "No " << Mapping::getLabel() << " exists for ID " << id;
+            throw DoesNotExistError(msg.str());
+        }
+
+        return *stored;
+    }
+
+    template <typename Value>
+    static Entity GetByField(const std::string& fieldname, const Value& value,
+            bool allowMany = false)
+    {
+        Entities entities;
+        FindEqual(fieldname, IndexKey(value), entities, allowMany ? 1 : 2);
+
+        if (entities.empty())
+        {
+            std::ostringstream msg;
+            msg << "No " << Mapping::getLabel() << " exists for field '"
+                << fieldname << "'";
+            throw DoesNotExistError(msg.str());
+        }
+
+        if (entities.size() > 1)
+        {
+            std::ostringstream msg;
+            msg << "More than one result for field '" << fieldname << "'";
+            throw NotOneError(msg.str());
+        }
+
+        return entities.front();
+    }
+
+    static Entities GetAll()
+    {
+        Entities entities;
+        GetAll(entities);
+        return entities;
+    }
+
+    static void GetAll(Entities& entities)
+    {
+        store().entities.all(entities);
+    }
+
+    template <typename Value>
+    static Entities GetManyByField(const std::string& fieldname, Value value)
+    {
+        Entities entities;
+        FindEqual(fieldname, IndexKey(value), entities,
+                  std::numeric_limits<size_t>::max());
+        return entities;
+    }
+
+    template <typename Value>
+    static Entities GetManyByRange(const std::string& fieldname,
+            const Value& from, const Value& to)
+    {
+        CheckField(fieldname);
+
+        Entities entities;
+        const Cache& cache = store().entities;
+        if (cache.hasIndex(fieldname, SORTED_INDEX))
+            cache.findRange(fieldname, IndexKey(from), IndexKey(to),
+                            entities);
+        else
+            cache.scanRange(fieldname, IndexKey(from), IndexKey(to),
+                            entities);
+        return entities;
+    }
+
+    static int64_t Count()
+    {
+        return static_cast<int64_t>(store().entities.size());
+    }
+
+    template <typename Value>
+    static int64_t Count(const std::string& filterField, const Value& value)
+    {
+        return static_cast<int64_t>(GetManyByField(filterField,
+                                                   value).size());
+    }
+
+    static void AddMemoryIndex(const std::string& fieldname,
+            MemoryIndexType type = HASH_INDEX)
+    {
+        CheckField(fieldname);
+
+        Cache& cache = store().entities;
+        cache.addIndex(fieldname, type);
+        cache.reindex();
+    }
+
+private:
+    typedef IndexedEntityCache<Entity, Mapping> Cache;
+
+    struct Store
+    {
+        Cache entities;
+        Id lastId;
+
+        Store() :
+            entities(), lastId(0)
+        { }
+    };
+
+    MemoryRepository();
+
+    static Store& store()
+    {
+        static Store s;
+        return s;
+    }
+
+    // undo actions
+
+    struct Restore
+    {
+        Entity entity;
+
+        Restore(const Entity& e) :
+            entity(e)
+        { }
+
+        void operator()() const
+        { store().entities.put(entity); }
+    };
+
+    struct Remove
+    {
+        Id id;
+
+        Remove(Id i) :
+            id(i)
+        { }
+
+        void operator()() const
+        { store().entities.remove(id); }
+    };
+
+    struct RestoreAll
+    {
+        Entities entities;
+
+        RestoreAll(const Entities& e) :
+            entities(e)
+        { }
+
+        void operator()() const
+        { store().entities.load(entities); }
+    };
+
+    static void CheckField(const std::string& fieldname)
+    {
+        if (!Cache::HasField(fieldname))
+            throw std::invalid_argument("No field '" + fieldname
+                    + "' in mapping of " + Mapping::getLabel());
+    }
+
+    static void FindEqual(const std::string& fieldname, const IndexKey& key,
+                          Entities& entities, size_t limit)
+    {
+        CheckField(fieldname);
+
+        const Cache& cache = store().entities;
+        if (cache.hasIndex(fieldname, HASH_INDEX))
+            cache.findEqual(fieldname, key, entities, limit);
+        else
+            cache.scanEqual(fieldname, key, entities, limit);
+    }
+
+    static int64_t VersionOf(const Entity& stored)
+    {
+        // accept() takes a non-const entity
+        Entity copy(stored);
+        VersionFieldFinder versionFinder;
+        Mapping::accept(versionFinder, copy);
+        return versionFinder.version().value();
+    }
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_MEMORYREPOSITORY_H__ */
@@ -0,0 +1,602 @@
+#ifndef DATAMAPPERCPP_MIGRATION_H__
+#define DATAMAPPERCPP_MIGRATION_H__
+
+#include <datamappercpp/sql/Repository.h>
+#include <datamappercpp/sql/Transaction.h>
+#include <datamappercpp/sql/db.h>
+#include <datamappercpp/sql/exceptions.h>
+
+#include <datamappercpp/sql/detail/SqlStatementBuilder.h>
+#include <datamappercpp/sql/detail/Stopwatch.h>
+#include <datamappercpp/sql/detail/ValueCodec.h>
+#include <datamappercpp/sql/detail/stdutil.h>
+
+#include <datamappercpp/Field.h>
+#include <datamappercpp/Index.h>
+
+#include <dbccpp/dbccpp.h>
+
+#include <utilcpp/disable_copy.h>
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cctype>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace dm {
+namespace sql {
+
+struct ColumnDefinition
+{
+    std::string name;
+    std::string type;
+    std::string options;
+    bool notNull;
+
+    ColumnDefinition() :
+        name(), type(), options(), notNull(false)
+    { }
+
+    // ALTER TABLE ADD COLUMN cannot add unique columns or NOT NULL columns
+    // without a default value.
+    bool canBeAdded() const
+    {
+        const std::string upper = ToUpper(options);
+        return upper.find("UNIQUE") == std::string::npos
+            && upper.find("PRIMARY KEY") == std::string::npos
+            && (!notNull || upper.find("DEFAULT") != std::string::npos);
+    }
+
+    std::string definition() const
+    { return options.empty() ? type : type + " " + options; }
+
+    static std::string ToUpper(std::string s)
+    {
+        for (size_t i = 0; i < s.size(); ++i)
+            s[i] = static_cast<char>(std::toupper(
+                        static_cast<unsigned char>(s[i])));
+        return s;
+    }
+};
+
+/**
+ * Difference between the mapping and the table in the database.
+ *
+ * Columns are compared by name, declared type and NOT NULL. Other
+ * constraint changes are not visible in PRAGMA table_info and are not
+ * detected.
+ */
+struct SchemaDiff
+{
+    bool tableExists;
+    // mapped columns missing from the table
+    std::vector<ColumnDefinition> added;
+    // mapped columns whose type or NOT NULL differs from the table
+    std::vector<ColumnDefinition> changed;
+    // table columns that are not mapped
+    std::vector<std::string> removed;
+
+    SchemaDiff() :
+        tableExists(false), added(), changed(), removed()
+    { }
+
+    bool empty() const
+    { return added.empty() && changed.empty() && removed.empty(); }
+
+    // whether ALTER TABLE ADD COLUMN is enough
+    bool additive() const
+    {
+        for (size_t i = 0; i < added.size(); ++i)
+            if (!added[i].canBeAdded())
+                return false;
+        return changed.empty() && removed.empty();
+    }
+};
+
+/**
+ * SQL expressions that fill mapped columns of a copying migration, keyed by
+ * column name and evaluated against the rows of the old table, e.g.
+ * "coalesce(size,0)". Columns without an expression are copied as is if
+ * the old table has them and get their DEFAULT otherwise.
+ */
+typedef std::map<std::string, std::string> ColumnExpressions;
+
+/**
+ * Whether a copying migration may drop the table columns that are no
+ * longer mapped, and their data.
+ */
+enum RemovedColumnPolicy
+{
+    FAIL_ON_REMOVED_COLUMNS,
+    DROP_REMOVED_COLUMNS
+};
+
+struct MigrationProgress
+{
+    size_t rowsCopied;
+    size_t totalRows;
+    double elapsedSeconds;
+
+    MigrationProgress() :
+        rowsCopied(0), totalRows(0), elapsedSeconds(0.0)
+    { }
+
+    double rowsPerSecond() const
+    { return elapsedSeconds > 0.0 ? rowsCopied / elapsedSeconds : 0.0; }
+};
+
+class ColumnDefinitionCollector
+{
+    UTILCPP_DISABLE_COPY(ColumnDefinitionCollector)
+
+public:
+    ColumnDefinitionCollector(std::vector<ColumnDefinition>& columns) :
+        _columns(columns)
+    { }
+
+    template <typename T>
+    void visitField(const Field<T>& field, const T& )
+    {
+        // typeDefinition() is the type followed by the options
+        const std::string definition = field.typeDefinition();
+        const size_t space = definition.find(' ');
+
+        ColumnDefinition column;
+        column.name = field.label;
+        column.type = definition.substr(0, space);
+        if (space != std::string::npos)
+            column.options = definition.substr(space + 1);
+        column.notNull = ColumnDefinition::ToUpper(column.options)
+            .find("NOT NULL") != std::string::npos;
+
+        _columns.push_back(column);
+    }
+
+private:
+    std::vector<ColumnDefinition>& _columns;
+};
+
+/**
+ * Brings the table of a mapping up to date with the mapping.
+ *
+ * Additive changes are applied with ALTER TABLE ADD COLUMN, along with
+ * newly declared indexes. Other changes copy the rows into a new table in
+ * chunks of small transactions while triggers mirror concurrent writes into
+ * it. The declared indexes are built on the new table before the copy
+ * under temporary names, so the transaction that swaps out the old table
+ * only drops it, renames the new table and its indexes and carries over
+ * the AUTOINCREMENT sequence. Index renames edit the schema table, if the
+ * connection does not allow that (SQLITE_DBCONFIG_DEFENSIVE) the indexes
+ * are rebuilt in the swap instead. customCreateStatements() refer to the
+ * table by name and also run in the swap, indexes declared in the mapping
+ * keep it short.
+ *
+ * Changed columns are converted by the column affinity. Columns that are
+ * no longer mapped are only dropped with DROP_REMOVED_COLUMNS, otherwise
+ * the migration throws MigrationError before changing anything.
+ *
+ * Rows that violate a constraint of the new table fail the migration
+ * instead of being skipped. The triggers and the new table are then
+ * dropped and the old table is left as it was.
+ */
+template <class Entity, class Mapping>
+class Migration
+{
+public:
+    typedef Repository<Entity, Mapping> EntityRepository;
+    typedef SqlStatementBuilder<Entity, Mapping> EntitySqlBuilder;
+    typedef stdutil::function<void (const MigrationProgress&)>
+        ProgressCallback;
+
+    enum { DEFAULT_CHUNK_ROWS = 1000 };
+
+    static SchemaDiff Diff()
+    {
+        SchemaDiff diff;
+
+        const std::vector<ColumnDefinition> table = TableColumns();
+        const std::vector<ColumnDefinition> mapped = MappedColumns();
+
+        diff.tableExists = !table.empty();
+
+        for (size_t i = 0; i < mapped.size(); ++i)
+        {
+            const ColumnDefinition* existing = Find(table, mapped[i].name);
+            if (!existing)
+                diff.added.push_back(mapped[i]);
+            else if (ColumnDefinition::ToUpper(existing->type)
+                        != ColumnDefinition::ToUpper(mapped[i].type)
+                    || existing->notNull != mapped[i].notNull)
+                diff.changed.push_back(mapped[i]);
+        }
+
+        for (size_t i = 0; i < table.size(); ++i)
+            if (ColumnDefinition::ToUpper(table[i].name) != "ID"
+                    && !Find(mapped, table[i].name))
+                diff.removed.push_back(table[i].name);
+
+        return diff;
+    }
+
+    /**
+     * Applies the difference and returns it. progress is called after
+     * each chunk of a copying migration.
+     */
+    static SchemaDiff Migrate(size_t chunkRows = DEFAULT_CHUNK_ROWS,
+            const ProgressCallback& progress = ProgressCallback(),
+            RemovedColumnPolicy removed = FAIL_ON_REMOVED_COLUMNS)
+    {
+        return Migrate(ColumnExpressions(), chunkRows, progress, removed);
+    }
+
+    /**
+     * As above, expressions fill the columns of a copying migration.
+     */
+    static SchemaDiff Migrate(const ColumnExpressions& expressions,
+            size_t chunkRows = DEFAULT_CHUNK_ROWS,
+            const ProgressCallback& progress = ProgressCallback(),
+            RemovedColumnPolicy removed = FAIL_ON_REMOVED_COLUMNS)
+    {
+        const SchemaDiff diff = Diff();
+
+        if (!diff.removed.empty() && removed != DROP_REMOVED_COLUMNS)
+            throw MigrationError("Migrating " + Mapping::getLabel()
+                    + " would drop the unmapped column "
+                    + diff.removed.front()
+                    + ", pass DROP_REMOVED_COLUMNS to drop it");
+
+        if (!diff.tableExists)
+            EntityRepository::CreateTable();
+        else if (diff.additive() && expressions.empty())
+            AddColumnsAndIndexes(diff);
+        else
+            CopyAndSwap(expressions, std::max<size_t>(1, chunkRows),
+                        progress);
+
+        return diff;
+    }
+
+private:
+    Migration();
+
+    static std::string CopyTable()
+    { return Mapping::getLabel() + "_migration"; }
+
+    // name of a declared index on the copy until the swap
+    static std::string CopyIndexName(const Index& index)
+    { return CopyTable() + "_" + index.name(Mapping::getLabel()); }
+
+    static std::vector<ColumnDefinition> TableColumns()
+    {
+        std::vector<ColumnDefinition> columns;
+
+        Statement statement = PrepareStatement("PRAGMA table_info("
+                + Mapping::getLabel() + ")");
+        dbc::ResultSet::ptr result(statement->executeQuery());
+
+        while (result->next())
+        {
+            ColumnDefinition column;
+            column.name = result->get<std::string>(1);
+            column.type = result->get<std::string>(2);
+            column.notNull = result->get<int>(3) != 0;
+            columns.push_back(column);
+        }
+
+        return columns;
+    }
+
+    static std::vector<ColumnDefinition> MappedColumns()
+    {
+        std::vector<ColumnDefinition> columns;
+        Entity entity;
+
+        ColumnDefinitionCollector collector(columns);
+        Mapping::accept(collector, entity);
+
+        return columns;
+    }
+
+    static const ColumnDefinition* Find(
+            const std::vector<ColumnDefinition>& columns,
+            const std::string& name)
+    {
+        const std::string upper = ColumnDefinition::ToUpper(name);
+        for (size_t i = 0; i < columns.size(); ++i)
+            if (ColumnDefinition::ToUpper(columns[i].name) == upper)
+                return &columns[i];
+        return 0;
+    }
+
+    static void AddColumnsAndIndexes(const SchemaDiff& diff)
+    {
+        Transaction transaction;
+
+        for (size_t i = 0; i < diff.added.size(); ++i)
+            ExecuteStatement("ALTER TABLE " + Mapping::getLabel()
+                    + " ADD COLUMN " + diff.added[i].name + " "
+                    + diff.added[i].definition());
+
+        // indexes that were declared after the table was created
+        std::string indexStatements(EntitySqlBuilder::CreateIndexStatements());
+        if (!indexStatements.empty())
+            ExecuteStatement(indexStatements);
+
+        transaction.commit();
+
+        EntityRepository::ResetStatements();
+        EntityRepository::RefreshMemoryIndexes();
+    }
+
+    static void CopyAndSwap(const ColumnExpressions& expressions,
+                            size_t chunkRows,
+                            const ProgressCallback& progress)
+    {
+        const std::string table = Mapping::getLabel();
+        const std::string copy = CopyTable();
+
+        // id and the mapped columns that the table already has or that
+        // have an expression, the others get their DEFAULT
+        const std::vector<ColumnDefinition> existing = TableColumns();
+        const std::vector<ColumnDefinition> mapped = MappedColumns();
+        std::string columns("id");
+        std::string values("id");
+        for (size_t i = 0; i < mapped.size(); ++i)
+        {
+            ColumnExpressions::const_iterator expression =
+                expressions.find(mapped[i].name);
+            if (expression != expressions.end())
+                values += "," + expression->second;
+            else if (Find(existing, mapped[i].name))
+                values += "," + mapped[i].name;
+            else
+                continue;
+            columns += "," + mapped[i].name;
+        }
+        const std::string insert = "INSERT INTO " + copy + " (" + columns
+            + ") SELECT " + values + " FROM " + table;
+
+        Stopwatch stopwatch;
+        MigrationProgress status;
+        status.totalRows = static_cast<size_t>(CountRows(table));
+
+        const Indexes indexes = IndexesOf<Mapping>::get();
+
+        try
+        {
+            {
+                Transaction transaction;
+
+                ExecuteStatement("DROP TABLE IF EXISTS " + copy);
+                ExecuteStatement(EntitySqlBuilder::CreateTableStatement(copy));
+
+                // built while the copy is empty and maintained by the
+                // chunks, the swap only renames them
+                for (size_t i = 0; i < indexes.size(); ++i)
+                    ExecuteStatement(EntitySqlBuilder::CreateIndexStatement(
+                                indexes[i], copy, CopyIndexName(indexes[i]),
+                                false));
+
+                // rows that change after their chunk has been copied
+                ExecuteStatement("CREATE TRIGGER " + copy + "_insert "
+                        "AFTER INSERT ON " + table + " BEGIN " + insert
+                        + " WHERE id=NEW.id; END");
+                ExecuteStatement("CREATE TRIGGER " + copy + "_update "
+                        "AFTER UPDATE ON " + table + " BEGIN DELETE FROM "
+                        + copy + " WHERE id=OLD.id; " + insert
+                        + " WHERE id=NEW.id; END");
+                ExecuteStatement("CREATE TRIGGER " + copy + "_delete "
+                        "AFTER DELETE ON " + table + " BEGIN DELETE FROM "
+                        + copy + " WHERE id=OLD.id; END");
+
+                transaction.commit();
+            }
+
+            CopyChunks(insert, chunkRows, progress, stopwatch, status);
+
+            // cached statements would keep the old table busy
+            EntityRepository::ResetStatements();
+
+            Transaction transaction;
+
+            DropTriggers();
+            const int64_t sequence = Sequence();
+            ExecuteStatement("DROP TABLE " + table);
+            ExecuteStatement("ALTER TABLE " + copy + " RENAME TO " + table);
+            RenameIndexes(indexes);
+            SetSequence(sequence);
+
+            std::string customStatements(Mapping::customCreateStatements());
+            if (!customStatements.empty())
+                ExecuteStatement(customStatements);
+
+            transaction.commit();
+        }
+        catch (...)
+        {
+            try
+            {
+                EntityRepository::ResetStatements();
+                DropTriggers();
+                ExecuteStatement("DROP TABLE IF EXISTS " + copy);
+            }
+            catch (...)
+            { }
+            throw;
+        }
+
+        EntityRepository::RefreshMemoryIndexes();
+    }
+
+    static void CopyChunks(const std::string& insert, size_t chunkRows,
+                           const ProgressCallback& progress,
+                           const Stopwatch& stopwatch,
+                           MigrationProgress& status)
+    {
+        const std::string table = Mapping::getLabel();
+
+        Statement nextChunk = PrepareStatement("SELECT count(*),max(id) "
+                "FROM (SELECT id FROM " + table
+                + " WHERE id>? ORDER BY id LIMIT ?)");
+        // rows already mirrored by the triggers are newer, skip them
+        Statement copyChunk = PrepareStatement(insert
+                + " WHERE id>? AND id<=? AND id NOT IN (SELECT id FROM "
+                + CopyTable() + " WHERE id>? AND id<=?)");
+
+        int64_t lastId = std::numeric_limits<int64_t>::min();
+
+        for (;;)
+        {
+            Transaction transaction;
+
+            nextChunk->reset();
+            nextChunk->clear();
+            ValueCodec<int64_t>::bind(nextChunk, lastId);
+            ValueCodec<int64_t>::bind(nextChunk,
+                    static_cast<int64_t>(chunkRows));
+
+            dbc::ResultSet::ptr result(nextChunk->executeQuery());
+            result->next();
+            const size_t rows = static_cast<size_t>(result->get<int>(0));
+            const int64_t chunkLastId = rows > 0 ?
+                ValueCodec<int64_t>::read(*result, 1) : lastId;
+            nextChunk->reset();
+
+            if (rows == 0)
+                break;
+
+            copyChunk->reset();
+            copyChunk->clear();
+            for (int i = 0; i < 2; ++i)
+            {
+                ValueCodec<int64_t>::bind(copyChunk, lastId);
+                ValueCodec<int64_t>::bind(copyChunk, chunkLastId);
+            }
+            copyChunk->executeUpdate();
+
+            transaction.commit();
+
+            lastId = chunkLastId;
+
+            status.rowsCopied += rows;
+            status.elapsedSeconds = stopwatch.elapsedSeconds();
+            if (progress)
+                progress(status);
+        }
+    }
+
+    /**
+     * Gives the indexes of the renamed copy their declared names by
+     * editing the schema table, which does not touch the index contents.
+     * Connections that do not allow it rebuild the indexes instead.
+     */
+    static void RenameIndexes(const Indexes& indexes)
+    {
+        if (indexes.empty())
+            return;
+
+        const std::string table = Mapping::getLabel();
+
+        Statement version = PrepareStatement("PRAGMA schema_version");
+        dbc::ResultSet::ptr result(version->executeQuery());
+        result->next();
+        const int64_t schemaVersion = ValueCodec<int64_t>::read(*result, 0);
+        version->reset();
+
+        bool renamed = true;
+        ExecuteStatement("PRAGMA writable_schema=ON");
+        try
+        {
+            Statement rename = PrepareStatement("UPDATE sqlite_master "
+                    "SET name=?,sql=? WHERE type='index' AND name=?");
+            for (size_t i = 0; i < indexes.size(); ++i)
+            {
+                rename->reset();
+                rename->clear();
+                *rename << indexes[i].name(table)
+                        << EntitySqlBuilder::CreateIndexStatement(indexes[i],
+                                table, indexes[i].name(table), false)
+                        << CopyIndexName(indexes[i]);
+                rename->executeUpdate();
+            }
+        }
+        catch (const dbc::DbErrorBase& )
+        {
+            // defensive connections do not allow writing the schema, the
+            // statement fails before any row is changed
+            renamed = false;
+        }
+
+        if (renamed)
+        {
+            // makes this and other connections reload the schema
+            std::ostringstream bump;
+            bump << "PRAGMA schema_version=" << schemaVersion + 1;
+            ExecuteStatement(bump.str());
+        }
+        ExecuteStatement("PRAGMA writable_schema=OFF");
+
+        if (renamed)
+            return;
+
+        for (size_t i = 0; i < indexes.size(); ++i)
+        {
+            ExecuteStatement("DROP INDEX " + CopyIndexName(indexes[i]));
+            ExecuteStatement(EntitySqlBuilder::CreateIndexStatement(
+                        indexes[i], table, indexes[i].name(table), false));
+        }
+    }
+
+    // AUTOINCREMENT sequence of the old table or of the copy, whichever
+    // is ahead, so that ids deleted from the end are not reused
+    static int64_t Sequence()
+    {
+        Statement statement = PrepareStatement("SELECT coalesce(max(seq),0) "
+                "FROM sqlite_sequence WHERE name IN (?,?)");
+        *statement << Mapping::getLabel() << CopyTable();
+        dbc::ResultSet::ptr result(statement->executeQuery());
+        result->next();
+        return ValueCodec<int64_t>::read(*result, 0);
+    }
+
+    static void SetSequence(int64_t sequence)
+    {
+        Statement remove = PrepareStatement("DELETE FROM sqlite_sequence "
+                "WHERE name=?");
+        *remove << Mapping::getLabel();
+        remove->executeUpdate();
+
+        Statement insert = PrepareStatement("INSERT INTO sqlite_sequence "
+                "(name,seq) VALUES (?,?)");
+        *insert << Mapping::getLabel();
+        ValueCodec<int64_t>::bind(insert, sequence);
+        insert->executeUpdate();
+    }
+
+    static void DropTriggers()
+    {
+        const std::string copy = CopyTable();
+
+        ExecuteStatement("DROP TRIGGER IF EXISTS " + copy + "_insert");
+        ExecuteStatement("DROP TRIGGER IF EXISTS " + copy + "_update");
+        ExecuteStatement("DROP TRIGGER IF EXISTS " + copy + "_delete");
+    }
+
+    static int64_t CountRows(const std::string& table)
+    {
+        Statement statement = PrepareStatement("SELECT count(*) FROM "
+                + table);
+        dbc::ResultSet::ptr result(statement->executeQuery());
+        result->next();
+        return ValueCodec<int64_t>::read(*result, 0);
+    }
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_MIGRATION_H__ */
@@ -0,0 +1,294 @@
+#ifndef DATAMAPPERCPP_READREPLICA_H__
+#define DATAMAPPERCPP_READREPLICA_H__
+
+#include <datamappercpp/sql/Repository.h>
+#include <datamappercpp/sql/SqliteBackend.h>
+#include <datamappercpp/sql/db.h>
+#include <datamappercpp/sql/exceptions.h>
+
+#include <datamappercpp/sql/detail/SqliteHandle.h>
+#include <datamappercpp/sql/detail/Stopwatch.h>
+
+#include <sqlite3.h>
+
+#include <utilcpp/disable_copy.h>
+
+#include <string>
+
+namespace dm {
+namespace sql {
+
+/**
+ * Copy of the database attached to the connection as schema "replica",
+ * refreshed with the SQLite backup API from a separate read-only
+ * connection to the database file.
+ *
+ * Queries of ReplicaRepository read the replica, so long scans do not hold
+ * read locks on the database file that writers, including other processes,
+ * would have to wait for. The replica is refreshed before a read when it
+ * is older than the staleness bound and the database has changed since
+ * the last refresh.
+ *
+ * The database must be a file. The replica is kept in memory by default.
+ */
+class ReadReplica
+{
+public:
+    static void attach(double maxStalenessSeconds,
+                       const std::string& path = ":memory:")
+    {
+        State& s = state();
+        if (s.source)
+            throw ReplicaError("Read replica is already attached");
+
+        const char* filename = sqlite3_db_filename(SqliteHandle::get(),
+                                                   "main");
+        if (!filename || !*filename)
+            throw ReplicaError("Read replica needs a database file");
+
+        sqlite3* source = 0;
+        if (sqlite3_open_v2(filename, &source, SQLITE_OPEN_READONLY, 0)
+                != SQLITE_OK)
+        {
+            const std::string msg = "Opening read replica source failed: "
+                + std::string(sqlite3_errmsg(source));
+            sqlite3_close(source);
+            throw ReplicaError(msg);
+        }
+
+        Statement statement = PrepareStatement("ATTACH DATABASE ? AS "
+                + schema());
+        *statement << path;
+        statement->executeUpdate();
+
+        s.source = source;
+        s.maxStalenessSeconds = maxStalenessSeconds;
+
+        refresh();
+    }
+
+    static void detach()
+    {
+        State& s = state();
+        if (!s.source)
+            return;
+
+        s.close();
+        ExecuteStatement("DETACH DATABASE " + schema());
+    }
+
+    static bool attached()
+    {
+        return state().source != 0;
+    }
+
+    static void setMaxStaleness(double seconds)
+    {
+        state().maxStalenessSeconds = seconds;
+    }
+
+    // Seconds since the replica was last known to match the database.
+    static double age()
+    {
+        return Stopwatch::now() - state().refreshed;
+    }
+
+    static void ensureFresh()
+    {
+        ensureFresh(state().maxStalenessSeconds);
+    }
+
+    // Refreshes the replica if it is older than maxStalenessSeconds, for
+    // reads that need a tighter bound than the configured one.
+    static void ensureFresh(double maxStalenessSeconds)
+    {
+        if (attached() && age() > maxStalenessSeconds)
+            refresh();
+    }
+
+    static void refresh()
+    {
+        State& s = state();
+        if (!s.source)
+            throw ReplicaError("Read replica is not attached");
+
+        const double now = Stopwatch::now();
+
+        // data_version of the source connection changes with every commit
+        // of another connection, copying an unchanged database is useless
+        const int version = dataVersion(s.source);
+        if (s.copied && version == s.dataVersion)
+        {
+            s.refreshed = now;
+            return;
+        }
+
+        sqlite3* destination = SqliteHandle::get();
+        sqlite3_backup* backup = sqlite3_backup_init(destination,
+                schema().c_str(), s.source, "main");
+        if (!backup)
+            throw ReplicaError("Starting read replica refresh failed: "
+                    + std::string(sqlite3_errmsg(destination)));
+
+        const int rc = sqlite3_backup_step(backup, -1);
+        sqlite3_backup_finish(backup);
+
+        if (rc != SQLITE_DONE)
+            throw ReplicaError("Refreshing read replica failed: "
+                    + std::string(sqlite3_errstr(rc)));
+
+        s.copied = true;
+        s.dataVersion = version;
+        s.refreshed = now;
+    }
+
+    // Table name qualified with the replica schema while one is attached.
+    static std::string table(const std::string& label)
+    {
+        return attached() ? schema() + "." + label : label;
+    }
+
+    // Schema that reads go to, the replica while one is attached.
+    static std::string readSchema()
+    {
+        return attached() ? schema() : "main";
+    }
+
+    static std::string schema()
+    {
+        return "replica";
+    }
+
+private:
+    struct State
+    {
+        UTILCPP_DISABLE_COPY(State)
+
+    public:
+        sqlite3* source;
+        double maxStalenessSeconds;
+        double refreshed;
+        int dataVersion;
+        bool copied;
+
+        State() :
+            source(0), maxStalenessSeconds(0.0), refreshed(0.0),
+            dataVersion(0), copied(false)
+        { }
+
+        ~State()
+        {
+            close();
+        }
+
+        void close()
+        {
+            sqlite3_close(source);
+            source = 0;
+            copied = false;
+        }
+    };
+
+    ReadReplica();
+
+    static State& state()
+    {
+        static State s;
+        return s;
+    }
+
+    static int dataVersion(sqlite3* db)
+    {
+        sqlite3_stmt* statement = 0;
+        int version = -1;
+
+        if (sqlite3_prepare_v2(db, "PRAGMA data_version", -1, &statement, 0)
+                == SQLITE_OK && sqlite3_step(statement) == SQLITE_ROW)
+            version = sqlite3_column_int(statement, 0);
+        sqlite3_finalize(statement);
+
+        return version;
+    }
+};
+
+/**
+ * Read-only access to entities that is routed to the ReadReplica while one
+ * is attached and to the database otherwise. Results may be as old as the
+ * staleness bound of the replica, writes go through Repository.
+ *
+ * Blob fields are read from the replica as well, lazy fields of the
+ * entities are loaded from the database.
+ */
+template <class Entity, class Mapping>
+class ReplicaRepository
+{
+public:
+    typedef Repository<Entity, Mapping> EntityRepository;
+    typedef typename EntityRepository::Entities Entities;
+    typedef typename EntityRepository::Id Id;
+
+    static Entity Get(Id id)
+    {
+        Statement statement = PrepareRead("id=?");
+        ValueCodec<Id>::bind(statement, id);
+
+        return EntityRepository::GetByQuery(statement, false,
+                                            ReadReplica::readSchema());
+    }
+
+    static Entities GetAll()
+    {
+        Statement statement = PrepareRead(std::string());
+
+        return Read(statement);
+    }
+
+    template <typename Value>
+    static Entities GetManyByField(const std::string& fieldname,
+                                   const Value& value)
+    {
+        Statement statement = PrepareRead(fieldname + "=?");
+        BindValue(statement, value);
+
+        return Read(statement);
+    }
+
+    template <typename Value>
+    static Entities GetManyByRange(const std::string& fieldname,
+            const Value& from, const Value& to)
+    {
+        Statement statement = PrepareRead(fieldname + " BETWEEN ? AND ?");
+        BindValue(statement, from);
+        BindValue(statement, to);
+
+        return Read(statement);
+    }
+
+private:
+    ReplicaRepository();
+
+    static Statement PrepareRead(const std::string& condition)
+    {
+        ReadReplica::ensureFresh();
+
+        std::string sql = "SELECT "
+            + EntityRepository::EntitySqlBuilder::SelectColumns(false)
+            + " FROM " + ReadReplica::table(Mapping::getLabel());
+        if (!condition.empty())
+            sql += " WHERE " + condition;
+
+        return PrepareStatement(sql);
+    }
+
+    static Entities Read(Statement& statement)
+    {
+        Entities entities;
+        EntityRepository::GetManyByQuery(statement, entities,
+                                         ReadReplica::readSchema());
+        return entities;
+    }
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_READREPLICA_H__ */
@@ -0,0 +1,145 @@
+#ifndef DATAMAPPERCPP_RELATION_H__
+#define DATAMAPPERCPP_RELATION_H__
+
+#include <datamappercpp/sql/Repository.h>
+
+#include <datamappercpp/sql/detail/stdutil.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace dm {
+namespace sql {
+
+/**
+ * Relations are declared in mappings and loaded for a whole collection with
+ * Repository::LoadRelated(), one IN (...) query per batch of keys instead of
+ * one query per entity. Related entities are matched to their owners
+ * through a hash table.
+ *
+ *   class AuthorMapping
+ *   {
+ *       typedef dm::sql::OneToMany<Author, Book, BookMapping, int64_t> Books;
+ *       static Books books()
+ *       { return Books(&Author::books, "author_id", &Book::authorId); }
+ *       ...
+ *   };
+ *
+ *   Author::list authors = AuthorRepository::GetAll();
+ *   AuthorRepository::LoadRelated(authors, AuthorMapping::books());
+ */
+
+/**
+ * Child entities whose foreign key field refers to the parent id, loaded
+ * into a std::vector<Child> member of the parent.
+ */
+template <class Parent, class Child, class ChildMapping, typename Key>
+class OneToMany
+{
+public:
+    typedef std::vector<Child> Children;
+
+    OneToMany(Children Parent::*children, const std::string& foreignKey,
+              Key Child::*key) :
+        _children(children), _foreignKey(foreignKey), _key(key)
+    { }
+
+    /**
+     * Replaces the children of all parents, in query order.
+     */
+    void load(std::vector<Parent>& parents) const
+    {
+        Positions positions;
+        std::vector<Key> keys;
+
+        for (size_t i = 0; i < parents.size(); ++i)
+        {
+            (parents[i].*_children).clear();
+
+            if (parents[i].id < 1)
+                continue;
+
+            Key key = static_cast<Key>(parents[i].id);
+            if (positions.find(key) == positions.end())
+                keys.push_back(key);
+            positions.insert(std::make_pair(key, i));
+        }
+
+        Children children;
+        Repository<Child, ChildMapping>::GetManyByFieldValues(_foreignKey,
+                keys, children);
+
+        for (size_t i = 0; i < children.size(); ++i)
+        {
+            std::pair<typename Positions::const_iterator,
+                      typename Positions::const_iterator>
+                range = positions.equal_range(children[i].*_key);
+            for (; range.first != range.second; ++range.first)
+                (parents[range.first->second].*_children).push_back(
+                        children[i]);
+        }
+    }
+
+private:
+    typedef stdutil::unordered_multimap<Key, size_t> Positions;
+
+    Children Parent::*_children;
+    std::string _foreignKey;
+    Key Child::*_key;
+};
+
+/**
+ * Target entity that the foreign key field of the entity refers to, loaded
+ * into a Target member of the entity.
+ */
+template <class Entity, class Target, class TargetMapping, typename Key>
+class ManyToOne
+{
+public:
+    ManyToOne(Target Entity::*target, Key Entity::*key) :
+        _target(target), _key(key)
+    { }
+
+    /**
+     * Entities whose target does not exist get a default-constructed one.
+     */
+    void load(std::vector<Entity>& entities) const
+    {
+        std::vector<Key> keys;
+        keys.reserve(entities.size());
+        for (size_t i = 0; i < entities.size(); ++i)
+            if (entities[i].*_key > 0)
+                keys.push_back(entities[i].*_key);
+
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+        std::vector<Target> targets;
+        targets.reserve(keys.size());
+        Repository<Target, TargetMapping>::GetManyByFieldValues("id", keys,
+                targets);
+
+        Positions positions;
+        for (size_t i = 0; i < targets.size(); ++i)
+            positions[static_cast<Key>(targets[i].id)] = i;
+
+        for (size_t i = 0; i < entities.size(); ++i)
+        {
+            typename Positions::const_iterator it =
+                positions.find(entities[i].*_key);
+            entities[i].*_target = it != positions.end() ?
+                targets[it->second] : Target();
+        }
+    }
+
+private:
+    typedef stdutil::unordered_map<Key, size_t> Positions;
+
+    Target Entity::*_target;
+    Key Entity::*_key;
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_RELATION_H__ */
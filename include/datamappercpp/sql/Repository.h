@@ -1,28 +1,34 @@
+#ifndef DATAMAPPERCPP_REPOSITORY_H__
+#define DATAMAPPERCPP_REPOSITORY_H__
+
+#include <datamappercpp/sql/BlobStream.h>
+#include <datamappercpp/sql/ChangeFeed.h>
 #include <datamappercpp/sql/Transaction.h>
 #include <datamappercpp/sql/db.h>
 #include <datamappercpp/sql/exceptions.h>
 
 #include <datamappercpp/sql/detail/SqlStatementBuilder.h>
+#include <datamappercpp/sql/detail/Backend.h>
+#include <datamappercpp/sql/detail/ColumnarFieldVisitors.h>
+#include <datamappercpp/sql/detail/MemoryIndex.h>
+#include <datamappercpp/sql/detail/LazyFieldLoader.h>
+#include <datamappercpp/sql/detail/MappingTraits.h>
+#include <datamappercpp/sql/detail/ValueCodec.h>
+#include <datamappercpp/sql/detail/stdutil.h>
+
+#include <datamappercpp/Blob.h>
+#include <datamappercpp/ColumnarTable.h>
+#include <datamappercpp/Lazy.h>
+#include <datamappercpp/Version.h>
 
 #include <dbccpp/dbccpp.h>
 
 #include <utilcpp/disable_copy.h>
 
 #include <vector>
-
-#if defined(__GXX_EXPERIMENTAL_CXX0X__) || (__cplusplus > 199711L)
-  #include <functional>
-  namespace dm
-  {
-      namespace stdutil = std;
-  }
-#else
-  #include <boost/function.hpp>
-  namespace dm
-  {
-      namespace stdutil = boost;
-  }
-#endif
+#include <map>
+#include <algorithm>
+#include <limits>
 
 namespace dm {
 namespace sql {
@@ -40,9 +46,31 @@ public:
     void visitField(const Field<T>& , const T& field)
     {
         // TODO: *_statement[label] = field
-        *_statement << field;
+        ValueCodec<T>::bind(_statement, field);
+    }
+
+    template <typename T>
+    void visitField(const Field<Lazy<T> >& , const Lazy<T>& field)
+    {
+        ValueCodec<T>::bind(_statement, field.get());
     }
 
+    // binds the size for zeroblob(), BlobWriter writes the contents
+    void visitField(const Field<Blob>& , const Blob& field)
+    {
+        ValueCodec<int64_t>::bind(_statement,
+                                  static_cast<int64_t>(field.size()));
+    }
+
+    void visitField(const Field<Lazy<Blob> >& field, const Lazy<Blob>& value)
+    {
+        visitField(Field<Blob>(field.label), value.get());
+    }
+
+    // versions are set by the statements, Save() binds the expected version
+    void visitField(const Field<Version>& , const Version& )
+    { }
+
 private:
     dbc::PreparedStatement::ptr& _statement;
 };
@@ -55,19 +83,151 @@ public:
     ObjectFieldBinder(const dbc::ResultSet& result) :
         _result(result),
         // index is 0-based, skip id, which is already set
-        _counter(1)
+        _counter(1),
+        _table(),
+        _id(-1),
+        _schema("main"),
+        _inlineBlobs(false)
+    {}
+
+    // Lazy and blob fields need to know where to load themselves from.
+    // inlineBlobs tells that the query selects blobs as
+    // SelectColumnsBuilder does.
+    ObjectFieldBinder(const dbc::ResultSet& result,
+                      const std::string& table, int64_t id,
+                      const std::string& schema = "main",
+                      bool inlineBlobs = false) :
+        _result(result),
+        _counter(1),
+        _table(table),
+        _id(id),
+        _schema(schema),
+        _inlineBlobs(inlineBlobs)
     {}
 
     template <typename T>
     void visitField(const Field<T>& , T& field)
     {
         // TODO: field = *_result[label]
-        field = _result.get<T>(_counter++);
+        field = ValueCodec<T>::read(_result, _counter++);
+    }
+
+    template <typename T>
+    void visitField(const Field<Lazy<T> >& lazyField, Lazy<T>& field)
+    {
+        // lazy columns are not selected, so the counter stays put
+        field.setLoader(LazyFieldLoader<T>(_table, lazyField.label, _id));
+    }
+
+    // Generated queries select small blobs as hex text and larger ones as
+    // NULL, which are read with incremental I/O. User queries may select
+    // the blob itself or nothing at all, so their column is not read.
+    void visitField(const Field<Blob>& blobField, Blob& field)
+    {
+        const int column = _counter++;
+        if (_inlineBlobs && !_result.isNull(column))
+            ReadHex(_result.getString(column), field);
+        else
+            BlobStream::Read(_table, blobField.label, _id, field, _schema);
+    }
+
+    void visitField(const Field<Version>& , Version& field)
+    {
+        field.set(ValueCodec<int64_t>::read(_result, _counter++));
     }
 
 private:
+    static void ReadHex(const std::string& hex, Blob& blob)
+    {
+        blob.resize(hex.size() / 2);
+        for (size_t i = 0; i < blob.size(); ++i)
+            blob[i] = static_cast<unsigned char>(
+                    HexDigit(hex[2 * i]) << 4 | HexDigit(hex[2 * i + 1]));
+    }
+
+    // hex() returns upper case digits
+    static int HexDigit(char c)
+    {
+        return c <= '9' ? c - '0' : c - 'A' + 10;
+    }
+
     const dbc::ResultSet& _result;
-    unsigned int _counter;
+    int _counter;
+    std::string _table;
+    int64_t _id;
+    std::string _schema;
+    bool _inlineBlobs;
+};
+
+class BlobWriter
+{
+    UTILCPP_DISABLE_COPY(BlobWriter)
+
+public:
+    BlobWriter(const std::string& table, int64_t id) :
+        _table(table),
+        _id(id)
+    {}
+
+    template <typename T>
+    void visitField(const Field<T>& , const T& )
+    { }
+
+    void visitField(const Field<Blob>& blobField, const Blob& field)
+    {
+        if (!field.empty())
+            BlobStream(_table, blobField.label, _id, true).write(field);
+    }
+
+    void visitField(const Field<Lazy<Blob> >& blobField,
+                    const Lazy<Blob>& field)
+    {
+        visitField(Field<Blob>(blobField.label), field.get());
+    }
+
+private:
+    std::string _table;
+    int64_t _id;
+};
+
+class LazyFieldSetter
+{
+    UTILCPP_DISABLE_COPY(LazyFieldSetter)
+
+public:
+    LazyFieldSetter(const dbc::ResultSet& result, const std::string& label,
+                    int column, const std::string& table, int64_t id) :
+        _result(result),
+        _label(label),
+        _column(column),
+        _table(table),
+        _id(id)
+    {}
+
+    template <typename T>
+    void visitField(const Field<T>& , T& )
+    { }
+
+    template <typename T>
+    void visitField(const Field<Lazy<T> >& lazyField, Lazy<T>& field)
+    {
+        if (lazyField.label == _label)
+            field.set(ValueCodec<T>::read(_result, _column));
+    }
+
+    // dbc-cpp cannot read blobs from result sets
+    void visitField(const Field<Lazy<Blob> >& lazyField, Lazy<Blob>& field)
+    {
+        if (lazyField.label == _label)
+            field.set(LazyFieldLoader<Blob>(_table, _label, _id)());
+    }
+
+private:
+    const dbc::ResultSet& _result;
+    const std::string& _label;
+    int _column;
+    std::string _table;
+    int64_t _id;
 };
 
 /**
@@ -76,12 +236,16 @@ private:
  *
  * Relies on Return Value Optimization and returns entities and collections by
  * copy.
+ *
+ * Entity ids are of type Mapping::id_type if the mapping declares it,
+ * int64_t otherwise.
  */
 template <class Entity, class Mapping>
 class Repository
 {
 public:
     typedef std::vector<Entity> Entities;
+    typedef typename IdTypeOf<Mapping>::type Id;
     typedef SqlStatementBuilder<Entity, Mapping> EntitySqlBuilder;
 
     static void CreateTable(bool enableTransaction = true)
@@ -96,12 +260,21 @@ public:
     static void Save(Entities& entities,
                      bool enableTransaction = true)
     {
-        Transaction transaction(enableTransaction);
+        try
+        {
+            Transaction transaction(enableTransaction);
 
-        for (size_t i = 0; i < entities.size(); ++i)
-            Save(entities[i], false);
+            for (size_t i = 0; i < entities.size(); ++i)
+                Save(entities[i], false);
 
-        transaction.commit();
+            transaction.commit();
+        }
+        catch (...)
+        {
+            // entities saved before the failure are already cached
+            RefreshMemoryIndexes();
+            throw;
+        }
     }
 
     static void Save(Entity& entity, bool enableTransaction = true)
@@ -125,13 +298,31 @@ public:
         StatementFieldBinder fieldbinder(statement);
         Mapping::accept(fieldbinder, entity);
 
+        VersionFieldFinder versionFinder;
+        Mapping::accept(versionFinder, entity);
+
         if (update)
+        {
             // update needs to to have ID bound as well
-            *statement << entity.id;
+            ValueCodec<Id>::bind(statement, entity.id);
+
+            // and the version that was loaded
+            if (versionFinder.found())
+                ValueCodec<int64_t>::bind(statement,
+                        versionFinder.version().value());
+        }
 
         Transaction transaction(enableTransaction);
 
         int howmany = statement->executeUpdate();
+        if (howmany == 0 && update && versionFinder.found())
+        {
+            std::ostringstream msg;
+            msg << Mapping::getLabel() << " with ID " << entity.id
+                << " and version " << versionFinder.version().value()
+                << " was changed or deleted concurrently";
+            throw ConcurrentModificationError(msg.str());
+        }
         if (howmany != 1)
         {
             std::ostringstream msg;
@@ -142,9 +333,35 @@ public:
 
         if (!update)
             // insert needs to set the object id after insert
-            entity.id = statement->getLastInsertId();
+            entity.id = static_cast<Id>(Backend::instance().lastInsertId());
+
+        BlobWriter blobWriter(Mapping::getLabel(), entity.id);
+        Mapping::accept(blobWriter, entity);
+
+        ChangeFeed::record(Mapping::getLabel(),
+                static_cast<int64_t>(entity.id),
+                update ? CHANGE_UPDATE : CHANGE_INSERT);
 
         transaction.commit();
+
+        if (versionFinder.found())
+        {
+            const int64_t version = update ?
+                versionFinder.version().value() + 1 : 1;
+
+            // an enclosing transaction may still be rolled back
+            Backend& backend = Backend::instance();
+            if (!backend.inTransaction())
+                versionFinder.version().set(version);
+            else
+                versionFinder.version().set(version,
+                        backend.transactionOutcome());
+        }
+
+        if (_memoryIndexes.enabled())
+            _memoryIndexes.put(entity);
+
+        ChangeFeed::publish();
     }
 
     static void Delete(Entity& entity,
@@ -159,13 +376,13 @@ public:
         entity.id = -1;
     }
 
-    static void Delete(int id,
+    static void Delete(Id id,
                 bool enableTransaction = true,
                 bool checkOneDeleted = true)
     {
         prepareStatement(_deleteEntityStatement,
                          &EntitySqlBuilder::DeleteByIdStatement);
-        *_deleteEntityStatement << id;
+        ValueCodec<Id>::bind(_deleteEntityStatement, id);
 
         Transaction transaction(enableTransaction);
 
@@ -178,7 +395,15 @@ public:
             throw NotOneError(msg.str());
         }
 
+        if (howmany > 0)
+            ChangeFeed::record(Mapping::getLabel(), static_cast<int64_t>(id),
+                               CHANGE_DELETE);
+
         transaction.commit();
+
+        _memoryIndexes.remove(id);
+
+        ChangeFeed::publish();
     }
 
     static void DeleteAll(bool enableTransaction = true)
@@ -187,10 +412,16 @@ public:
 
         ExecuteStatement(EntitySqlBuilder::DeleteAllStatement());
 
+        ChangeFeed::record(Mapping::getLabel(), 0, CHANGE_DELETE_ALL);
+
         transaction.commit();
+
+        _memoryIndexes.clear();
+
+        ChangeFeed::publish();
     }
 
-    static Entity Get(int id)
+    static Entity Get(Id id)
     {
         // note that SELECTs are outside transactions and
         // mixing them with ongoing transactions may cause problems
@@ -200,7 +431,7 @@ public:
 
         prepareStatement(_getEntityByIdStatement,
                          &EntitySqlBuilder::SelectByIdStatement);
-        *_getEntityByIdStatement << id;
+        ValueCodec<Id>::bind(_getEntityByIdStatement, id);
 
         return GetByQueryImpl(_getEntityByIdStatement, false, id);
     }
@@ -209,9 +440,17 @@ public:
     static Entity GetByField(const std::string& fieldname, const Value& value,
             bool allowMany = false)
     {
+        if (_memoryIndexes.hasIndex(fieldname, HASH_INDEX))
+        {
+            Entities entities;
+            _memoryIndexes.findEqual(fieldname, IndexKey(value), entities,
+                                     allowMany ? 1 : 2);
+            return GetByIndexImpl(entities, fieldname);
+        }
+
         Statement statement = PrepareStatement(
                 EntitySqlBuilder::SelectByFieldStatement(fieldname));
-        *statement << value;
+        BindValue(statement, value);
         return GetByQueryImpl(statement, allowMany, -1);
     }
 
@@ -222,30 +461,118 @@ public:
         return GetByQueryImpl(statement, allowMany, -1);
     }
 
+    /**
+     * schema is the database that blob fields are read from, for queries
+     * of attached databases.
+     */
     static Entity GetByQuery(Statement& statement,
-            bool allowMany = false)
+            bool allowMany = false,
+            const std::string& schema = "main")
     {
-        return GetByQueryImpl(statement, allowMany, -1);
+        return GetByQueryImpl(statement, allowMany, -1, schema);
     }
 
     static Entities GetAll()
+    {
+        Entities entities;
+        GetAll(entities);
+        return entities;
+    }
+
+    static void GetAll(Entities& entities)
     {
         prepareStatement(_getAllEntitiesStatement,
                          &EntitySqlBuilder::SelectAllStatement);
 
-        return GetManyByQuery(_getAllEntitiesStatement);
+        GetManyByQuery(_getAllEntitiesStatement, entities);
     }
 
     template <typename Value>
     static Entities GetManyByField(const std::string& fieldname, Value value)
     {
+        if (_memoryIndexes.hasIndex(fieldname, HASH_INDEX))
+        {
+            Entities entities;
+            _memoryIndexes.findEqual(fieldname, IndexKey(value), entities,
+                                     std::numeric_limits<size_t>::max());
+            return entities;
+        }
+
         Statement statement = PrepareStatement(
                 EntitySqlBuilder::SelectByFieldStatement(fieldname));
-        *statement << value;
+        BindValue(statement, value);
+
+        return GetManyByQuery(statement);
+    }
+
+    /**
+     * Returns entities with from <= field <= to. Served from a sorted
+     * memory index, in id order, when one exists for the field.
+     */
+    template <typename Value>
+    static Entities GetManyByRange(const std::string& fieldname,
+            const Value& from, const Value& to)
+    {
+        if (_memoryIndexes.hasIndex(fieldname, SORTED_INDEX))
+        {
+            Entities entities;
+            _memoryIndexes.findRange(fieldname, IndexKey(from), IndexKey(to),
+                                     entities);
+            return entities;
+        }
+
+        Statement statement = PrepareStatement(
+                EntitySqlBuilder::SelectByFieldRangeStatement(fieldname));
+        BindValue(statement, from);
+        BindValue(statement, to);
 
         return GetManyByQuery(statement);
     }
 
+    /**
+     * Appends entities whose field equals any of the values to entities,
+     * with one IN (...) query per batch of values.
+     */
+    template <typename Value>
+    static void GetManyByFieldValues(const std::string& fieldname,
+            const std::vector<Value>& values, Entities& entities)
+    {
+        for (size_t first = 0; first < values.size();
+             first += MAX_STATEMENT_PARAMETERS)
+        {
+            const size_t count = std::min<size_t>(MAX_STATEMENT_PARAMETERS,
+                                                  values.size() - first);
+
+            Statement statement = PrepareStatement(
+                    EntitySqlBuilder::SelectByFieldValuesStatement(fieldname,
+                                                                   count));
+            for (size_t i = first; i < first + count; ++i)
+                BindValue(statement, values[i]);
+
+            GetManyByQuery(statement, entities);
+        }
+    }
+
+    /**
+     * Appends at most count entities with id greater than afterId to
+     * entities, in id order. Passing the id of the last entity of a batch
+     * as afterId of the next one pages through the table with an index
+     * lookup per batch.
+     */
+    static void GetBatchAfter(Id afterId, size_t count, Entities& entities)
+    {
+        prepareStatement(_getBatchAfterIdStatement,
+                         &EntitySqlBuilder::SelectBatchAfterIdStatement);
+        ValueCodec<Id>::bind(_getBatchAfterIdStatement, afterId);
+        ValueCodec<int64_t>::bind(_getBatchAfterIdStatement,
+                                  static_cast<int64_t>(count));
+
+        GetManyByQuery(_getBatchAfterIdStatement, entities);
+
+        // release the read lock of the shared statement right away
+        _getBatchAfterIdStatement->reset();
+    }
+
     static Entities GetManyByQuery(const std::string& sql)
     {
         Statement statement = PrepareStatement(sql);
@@ -255,20 +582,358 @@ public:
     static Entities GetManyByQuery(Statement& statement)
     {
         Entities entities;
+        GetManyByQuery(statement, entities);
+        return entities;
+    }
+
+    /**
+     * Appends the results of the query to entities.
+     *
+     * Rows are filled in place instead of being copied into the
+     * collection, and a collection that is clear()-ed and reused for
+     * consecutive batches keeps its capacity, so loading a batch costs only
+     * the field values themselves.
+     */
+    static void GetManyByQuery(Statement& statement, Entities& entities,
+            const std::string& schema = "main")
+    {
+        const bool inlineBlobs = SelectsInlineBlobs(statement);
         dbc::ResultSet::ptr result(statement->executeQuery());
 
         while (result->next())
         {
-            Entity entity;
-            entity.id = (*result)[0];
+            entities.resize(entities.size() + 1);
+            Entity& entity = entities.back();
+
+            try
+            {
+                entity.id = static_cast<Id>(ValueCodec<int64_t>::read(*result, 0));
+
+                ObjectFieldBinder fieldbinder(*result, Mapping::getLabel(),
+                                              entity.id, schema, inlineBlobs);
+                Mapping::accept(fieldbinder, entity);
+            }
+            catch (...)
+            {
+                entities.pop_back();
+                throw;
+            }
+        }
+    }
 
-            ObjectFieldBinder fieldbinder(*result);
-            Mapping::accept(fieldbinder, entity);
+    /**
+     * Aggregates are computed by SQLite and returned as scalars, without
+     * loading any entities. The statements are prepared once per
+     * aggregate and filter field and reused.
+     */
+    static int64_t Count()
+    {
+        return Aggregate<int64_t>("count(*)");
+    }
 
-            entities.push_back(entity);
+    template <typename Value>
+    static int64_t Count(const std::string& filterField, const Value& value)
+    {
+        return Aggregate<int64_t>("count(*)", filterField, value);
+    }
+
+    static bool Exists()
+    {
+        Statement& statement = CachedStatement(
+                EntitySqlBuilder::ExistsStatement(std::string()));
+        return ReadAggregate<bool>(statement, "exists");
+    }
+
+    template <typename Value>
+    static bool Exists(const std::string& filterField, const Value& value)
+    {
+        Statement& statement = CachedStatement(
+                EntitySqlBuilder::ExistsStatement(filterField));
+        BindValue(statement, value);
+        return ReadAggregate<bool>(statement, "exists");
+    }
+
+    // Sum of an empty table or selection is 0. Integer fields are summed
+    // as int64_t, see SumTypeOf.
+    template <typename T>
+    static typename SumTypeOf<T>::type Sum(const Field<T>& field)
+    {
+        return Aggregate<typename SumTypeOf<T>::type>(SumOf(field));
+    }
+
+    template <typename T, typename Value>
+    static typename SumTypeOf<T>::type Sum(const Field<T>& field,
+            const std::string& filterField, const Value& value)
+    {
+        return Aggregate<typename SumTypeOf<T>::type>(SumOf(field),
+                                                      filterField, value);
+    }
+
+    // Min(), Max() and Avg() of an empty table or selection throw
+    // DoesNotExistError.
+    template <typename T>
+    static T Min(const Field<T>& field)
+    {
+        return Aggregate<T>("min(" + field.label + ")");
+    }
+
+    template <typename T, typename Value>
+    static T Min(const Field<T>& field, const std::string& filterField,
+                 const Value& value)
+    {
+        return Aggregate<T>("min(" + field.label + ")", filterField, value);
+    }
+
+    template <typename T>
+    static T Max(const Field<T>& field)
+    {
+        return Aggregate<T>("max(" + field.label + ")");
+    }
+
+    template <typename T, typename Value>
+    static T Max(const Field<T>& field, const std::string& filterField,
+                 const Value& value)
+    {
+        return Aggregate<T>("max(" + field.label + ")", filterField, value);
+    }
+
+    template <typename T>
+    static double Avg(const Field<T>& field)
+    {
+        return Aggregate<double>("avg(" + field.label + ")");
+    }
+
+    template <typename T, typename Value>
+    static double Avg(const Field<T>& field, const std::string& filterField,
+                      const Value& value)
+    {
+        return Aggregate<double>("avg(" + field.label + ")", filterField,
+                                 value);
+    }
+
+    /**
+     * Reads the whole table into per-column arrays without constructing
+     * an entity per row.
+     */
+    static ColumnarTable GetAllColumns()
+    {
+        prepareStatement(_getAllColumnsStatement,
+                         &EntitySqlBuilder::SelectAllColumnsStatement);
+
+        ColumnarTable table;
+        Entity entity;
+
+        ColumnDeclarationCollector collector(table);
+        Mapping::accept(collector, entity);
+
+        dbc::ResultSet::ptr result(_getAllColumnsStatement->executeQuery());
+
+        while (result->next())
+        {
+            table.ids.push_back(ValueCodec<int64_t>::read(*result, 0));
+
+            ColumnFiller filler(table, *result);
+            Mapping::accept(filler, entity);
         }
 
-        return entities;
+        return table;
+    }
+
+    /**
+     * Inserts all rows of the table as new entities with multi-row INSERT
+     * statements and stores their ids in table.ids.
+     *
+     * The ids are assigned explicitly, counting up from the larger of the
+     * highest id and the AUTOINCREMENT sequence of the table, as SQLite
+     * does not guarantee that the rows of one INSERT get consecutive ids.
+     * Without enableTransaction the caller's transaction has to include
+     * the inserts, so that no other writer takes the ids in between.
+     *
+     * Columns must be in mapping field order, as returned by
+     * GetAllColumns().
+     */
+    static void InsertColumns(ColumnarTable& table,
+                              bool enableTransaction = true)
+    {
+        const size_t fieldCount = EntitySqlBuilder::FieldCount();
+        if (table.columns.size() != fieldCount)
+            throw std::invalid_argument("Column count does not match "
+                                        "mapping field count");
+
+        const size_t rows = table.columns.empty() ? 0 :
+            ColumnValidator::RowCount(table.columns.front());
+
+        Entity entity;
+        ColumnValidator validator(table, rows);
+        Mapping::accept(validator, entity);
+
+        const size_t batchSize = std::max<size_t>(1,
+                std::min<size_t>(MAX_BATCH_ROWS,
+                    MAX_STATEMENT_PARAMETERS / (fieldCount + 1)));
+
+        Statement batchStatement;
+        size_t batchStatementRows = 0;
+
+        table.ids.resize(rows);
+
+        Transaction transaction(enableTransaction);
+
+        const int64_t firstId = NextId();
+        for (size_t row = 0; row < rows; ++row)
+            table.ids[row] = firstId + static_cast<int64_t>(row);
+
+        for (size_t first = 0; first < rows; first += batchSize)
+        {
+            const size_t count = std::min(batchSize, rows - first);
+
+            if (count != batchStatementRows)
+            {
+                batchStatement = PrepareStatement(
+                        EntitySqlBuilder::BatchInsertStatement(count, true));
+                batchStatementRows = count;
+            }
+            else
+            {
+                batchStatement->reset();
+                batchStatement->clear();
+            }
+
+            ColumnBinder binder(table, batchStatement);
+            for (size_t row = first; row < first + count; ++row)
+            {
+                ValueCodec<int64_t>::bind(batchStatement, table.ids[row]);
+                binder.setRow(row);
+                Mapping::accept(binder, entity);
+            }
+
+            int howmany = batchStatement->executeUpdate();
+            if (howmany != static_cast<int>(count))
+            {
+                std::ostringstream msg;
+                msg << howmany << " rows affected while inserting batch "
+                    << "instead of " << count;
+                throw NotOneError(msg.str());
+            }
+        }
+
+        if (ChangeFeed::active())
+            for (size_t row = 0; row < rows; ++row)
+                ChangeFeed::record(Mapping::getLabel(), table.ids[row],
+                                   CHANGE_INSERT);
+
+        transaction.commit();
+
+        RefreshMemoryIndexes();
+
+        ChangeFeed::publish();
+    }
+
+    /**
+     * Sets the given BLOB field of an entity to size zero bytes, to be
+     * filled in chunks through a writable BlobStream.
+     */
+    static void AllocateBlob(Id id, const std::string& fieldname,
+            size_t size, bool enableTransaction = true)
+    {
+        Statement statement = PrepareStatement(
+                EntitySqlBuilder::AllocateBlobStatement(fieldname));
+        ValueCodec<int64_t>::bind(statement, static_cast<int64_t>(size));
+        ValueCodec<Id>::bind(statement, id);
+
+        Transaction transaction(enableTransaction);
+
+        int howmany = statement->executeUpdate();
+        if (howmany != 1)
+        {
+            std::ostringstream msg;
+            msg << howmany << " rows affected while allocating blob "
+                << "instead of 1";
+            throw NotOneError(msg.str());
+        }
+
+        transaction.commit();
+    }
+
+    /**
+     * Loads the given lazy field of all entities with one query per
+     * batch of ids instead of one query per entity.
+     */
+    static void Prefetch(Entities& entities, const std::string& fieldname)
+    {
+        std::map<Id, size_t> positions;
+        for (size_t i = 0; i < entities.size(); ++i)
+            positions[entities[i].id] = i;
+
+        std::vector<Id> ids;
+        ids.reserve(positions.size());
+        for (typename std::map<Id, size_t>::const_iterator it = positions.begin();
+             it != positions.end(); ++it)
+            ids.push_back(it->first);
+
+        for (size_t first = 0; first < ids.size();
+             first += MAX_STATEMENT_PARAMETERS)
+        {
+            const size_t count = std::min<size_t>(MAX_STATEMENT_PARAMETERS,
+                                                  ids.size() - first);
+
+            Statement statement = PrepareStatement(
+                    EntitySqlBuilder::SelectFieldByIdsStatement(fieldname,
+                                                                count));
+            for (size_t i = first; i < first + count; ++i)
+                ValueCodec<Id>::bind(statement, ids[i]);
+
+            dbc::ResultSet::ptr result(statement->executeQuery());
+            while (result->next())
+            {
+                Id id = static_cast<Id>(ValueCodec<int64_t>::read(*result, 0));
+
+                LazyFieldSetter setter(*result, fieldname, 1,
+                                       Mapping::getLabel(), id);
+                Mapping::accept(setter, entities[positions[id]]);
+            }
+        }
+    }
+
+    /**
+     * Eagerly loads the related entities of all entities with one query
+     * per batch instead of one query per entity, see Relation.h.
+     */
+    template <class Relation>
+    static void LoadRelated(Entities& entities, const Relation& relation)
+    {
+        relation.load(entities);
+    }
+
+    /**
+     * Keeps all entities of the table cached in memory with an index over
+     * the given field. GetByField() and GetManyByField() (and
+     * GetManyByRange() for sorted indexes) are then answered from memory
+     * instead of the database. Save(), Delete() and DeleteAll() keep the
+     * cache up to date.
+     *
+     * Changes that bypass the repository or are rolled back by an
+     * enclosing transaction need RefreshMemoryIndexes().
+     */
+    static void AddMemoryIndex(const std::string& fieldname,
+            MemoryIndexType type = HASH_INDEX)
+    {
+        if (!MemoryIndexes::HasField(fieldname))
+            throw std::invalid_argument("No field '" + fieldname
+                    + "' in mapping of " + Mapping::getLabel());
+
+        _memoryIndexes.addIndex(fieldname, type);
+        RefreshMemoryIndexes();
+    }
+
+    static void RefreshMemoryIndexes()
+    {
+        if (_memoryIndexes.enabled())
+            _memoryIndexes.load(GetAll());
+    }
+
+    static void DropMemoryIndexes()
+    {
+        _memoryIndexes.dropIndexes();
     }
 
     static void ResetStatements()
@@ -281,6 +946,10 @@ public:
         _deleteEntityStatement.reset();
         _getEntityByIdStatement.reset();
         _getAllEntitiesStatement.reset();
+        _getAllColumnsStatement.reset();
+        _getBatchAfterIdStatement.reset();
+        _cachedStatements.clear();
+        LazyStatements::reset(Mapping::getLabel());
     }
 
 private:
@@ -291,6 +960,20 @@ private:
     static Statement _deleteEntityStatement;
     static Statement _getEntityByIdStatement;
     static Statement _getAllEntitiesStatement;
+    static Statement _getAllColumnsStatement;
+    static Statement _getBatchAfterIdStatement;
+    // statements of queries with variable SQL, keyed by SQL
+    static std::map<std::string, Statement> _cachedStatements;
+
+    typedef IndexedEntityCache<Entity, Mapping> MemoryIndexes;
+    static MemoryIndexes _memoryIndexes;
+
+    enum
+    {
+        // SQLite default SQLITE_MAX_VARIABLE_NUMBER is 999
+        MAX_STATEMENT_PARAMETERS = 999,
+        MAX_BATCH_ROWS = 500
+    };
 
     inline static void prepareStatement(Statement& statement,
             stdutil::function<std::string (void)> createSqlStatement)
@@ -306,8 +989,126 @@ private:
         }
     }
 
+    // Id after both the rows and the AUTOINCREMENT sequence of the table,
+    // so that ids of deleted rows are not reused.
+    static int64_t NextId()
+    {
+        int64_t last = QueryInt64("SELECT coalesce(max(id),0) FROM "
+                + Mapping::getLabel());
+
+        // sqlite_sequence only exists once an AUTOINCREMENT table has
+        if (QueryInt64("SELECT count(*) FROM sqlite_master "
+                    "WHERE type='table' AND name='sqlite_sequence'") > 0)
+            last = std::max(last, QueryInt64("SELECT coalesce(max(seq),0) "
+                        "FROM sqlite_sequence WHERE name='"
+                        + Mapping::getLabel() + "'"));
+
+        return last + 1;
+    }
+
+    static int64_t QueryInt64(const std::string& sql)
+    {
+        Statement statement = PrepareStatement(sql);
+        dbc::ResultSet::ptr result(statement->executeQuery());
+        result->next();
+        return ValueCodec<int64_t>::read(*result, 0);
+    }
+
+    static bool SelectsInlineBlobs(Statement& statement)
+    {
+        return EntitySqlBuilder::HasBlobFields()
+            && EntitySqlBuilder::SelectsInlineBlobs(statement->getSQL());
+    }
+
+    static Statement& CachedStatement(const std::string& sql)
+    {
+        Statement& statement = _cachedStatements[sql];
+
+        if (!statement)
+        {
+            statement = PrepareStatement(sql);
+        }
+        else
+        {
+            statement->reset();
+            statement->clear();
+        }
+
+        return statement;
+    }
+
+    template <typename T>
+    static std::string SumOf(const Field<T>& field)
+    {
+        return "coalesce(sum(" + field.label + "),0)";
+    }
+
+    template <typename T>
+    static T Aggregate(const std::string& aggregate)
+    {
+        Statement& statement = CachedStatement(
+                EntitySqlBuilder::AggregateStatement(aggregate,
+                                                     std::string()));
+        return ReadAggregate<T>(statement, aggregate);
+    }
+
+    template <typename T, typename Value>
+    static T Aggregate(const std::string& aggregate,
+                       const std::string& filterField, const Value& value)
+    {
+        Statement& statement = CachedStatement(
+                EntitySqlBuilder::AggregateStatement(aggregate, filterField));
+        BindValue(statement, value);
+        return ReadAggregate<T>(statement, aggregate);
+    }
+
+    template <typename T>
+    static T ReadAggregate(Statement& statement, const std::string& aggregate)
+    {
+        dbc::ResultSet::ptr result(statement->executeQuery());
+
+        if (!result->next() || result->isNull(0))
+        {
+            statement->reset();
+
+            std::ostringstream msg;
+            msg << "No " << Mapping::getLabel() << " rows for " << aggregate
+                << " in query '" << statement->getSQL() << "'";
+            throw DoesNotExistError(msg.str());
+        }
+
+        T value = ValueCodec<T>::read(*result, 0);
+
+        // release the read lock of the cached statement right away
+        statement->reset();
+
+        return value;
+    }
+
+    inline static Entity GetByIndexImpl(const Entities& entities,
+            const std::string& fieldname)
+    {
+        if (entities.empty())
+        {
+            std::ostringstream msg;
+            msg << "No " << Mapping::getLabel() << " exists for field '"
+                << fieldname << "' in memory index";
+            throw DoesNotExistError(msg.str());
+        }
+
+        if (entities.size() > 1)
+        {
+            std::ostringstream msg;
+            msg << "More than one result for field '" << fieldname
+                << "' in memory index";
+            throw NotOneError(msg.str());
+        }
+
+        return entities.front();
+    }
+
     inline static Entity GetByQueryImpl(Statement& statement,
-            bool allowMany, int id)
+            bool allowMany, Id id, const std::string& schema = "main")
     {
         Entity entity;
 
@@ -317,7 +1118,7 @@ private:
         try
         {
             // TODO: entity.id << *result;
-            entity.id = (*result)[0];
+            entity.id = static_cast<Id>(ValueCodec<int64_t>::read(*result, 0));
         }
         catch (const dbc::NoResultsError& e)
         {
@@ -327,7 +1128,8 @@ private:
             throw DoesNotExistError(msg.str());
         }
 
-        ObjectFieldBinder fieldbinder(*result);
+        ObjectFieldBinder fieldbinder(*result, Mapping::getLabel(), entity.id,
+                                      schema, SelectsInlineBlobs(statement));
         Mapping::accept(fieldbinder, entity);
 
         if (!allowMany && result->next())
@@ -361,4 +1163,19 @@ dbc::PreparedStatement::ptr Repository<Entity, Mapping>::_getEntityByIdStatement
 template <class Entity, class Mapping>
 dbc::PreparedStatement::ptr Repository<Entity, Mapping>::_getAllEntitiesStatement;
 
+template <class Entity, class Mapping>
+dbc::PreparedStatement::ptr Repository<Entity, Mapping>::_getAllColumnsStatement;
+
+template <class Entity, class Mapping>
+dbc::PreparedStatement::ptr Repository<Entity, Mapping>::_getBatchAfterIdStatement;
+
+template <class Entity, class Mapping>
+std::map<std::string, dbc::PreparedStatement::ptr>
+Repository<Entity, Mapping>::_cachedStatements;
+
+template <class Entity, class Mapping>
+IndexedEntityCache<Entity, Mapping> Repository<Entity, Mapping>::_memoryIndexes;
+
 } }
+
+#endif /* DATAMAPPERCPP_REPOSITORY_H__ */
@@ -0,0 +1,695 @@
+#ifndef DATAMAPPERCPP_SNAPSHOT_H__
+#define DATAMAPPERCPP_SNAPSHOT_H__
+
+#include <datamappercpp/sql/Repository.h>
+#include <datamappercpp/sql/exceptions.h>
+
+#include <datamappercpp/sql/detail/ColumnarFieldVisitors.h>
+#include <datamappercpp/sql/detail/MappedFile.h>
+
+#include <datamappercpp/ColumnarTable.h>
+#include <datamappercpp/Field.h>
+#include <datamappercpp/Lazy.h>
+#include <datamappercpp/Version.h>
+
+#include <utilcpp/disable_copy.h>
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace dm {
+namespace sql {
+
+/**
+ * On-disk layout of a table snapshot. All sections start at 8-byte aligned
+ * offsets so that a memory-mapped file can be read in place:
+ *
+ *   Header
+ *   ColumnHeader[columnCount]
+ *   int64_t ids[rowCount]            in row order
+ *   IndexEntry index[rowCount]       sorted by id
+ *   per column:
+ *     INTEGER: int64_t[rowCount]
+ *     REAL:    double[rowCount]
+ *     TEXT:    uint64_t offsets[rowCount + 1], string heap
+ *
+ * Numbers are stored in host byte order, a version mismatch on load also
+ * catches snapshots written on a machine with different byte order.
+ */
+namespace snapshot
+{
+    enum
+    {
+        FORMAT_VERSION = 2,
+        LABEL_SIZE = 48,
+        ALIGNMENT = 8
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t columnCount;
+        uint64_t rowCount;
+        uint64_t idsOffset;
+        uint64_t indexOffset;
+        uint64_t fileSize;
+    };
+
+    struct ColumnHeader
+    {
+        char label[LABEL_SIZE];
+        uint32_t type;
+        uint32_t reserved;
+        uint64_t dataOffset;
+        uint64_t offsetsOffset;
+        uint64_t dataSize;
+    };
+
+    struct IndexEntry
+    {
+        int64_t id;
+        uint64_t row;
+
+        bool operator<(const IndexEntry& rhs) const
+        { return id < rhs.id; }
+    };
+
+    inline const char* magic()
+    { return "DMSNAP\x01"; } // 7 chars + terminating zero
+
+    inline uint64_t align(uint64_t offset)
+    { return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT; }
+}
+
+class SnapshotWriter
+{
+public:
+    static void Write(const ColumnarTable& table, const std::string& path)
+    {
+        using namespace snapshot;
+
+        const uint64_t rows = table.size();
+
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, magic(), sizeof(header.magic));
+        header.version = FORMAT_VERSION;
+        header.columnCount = static_cast<uint32_t>(table.columns.size());
+        header.rowCount = rows;
+
+        uint64_t offset = sizeof(Header)
+            + table.columns.size() * sizeof(ColumnHeader);
+
+        header.idsOffset = align(offset);
+        offset = header.idsOffset + rows * sizeof(int64_t);
+
+        header.indexOffset = align(offset);
+        offset = header.indexOffset + rows * sizeof(IndexEntry);
+
+        std::vector<ColumnHeader> columns(table.columns.size());
+        for (size_t i = 0; i < table.columns.size(); ++i)
+        {
+            const ColumnarTable::Column& column = table.columns[i];
+            ColumnHeader& columnHeader = columns[i];
+
+            if (column.label.size() >= LABEL_SIZE)
+                throw SnapshotError("Column label '" + column.label
+                        + "' is too long for a snapshot");
+
+            std::memset(&columnHeader, 0, sizeof(columnHeader));
+            std::memcpy(columnHeader.label, column.label.data(),
+                        column.label.size());
+            columnHeader.type = column.type;
+
+            switch (column.type)
+            {
+                case ColumnarTable::INTEGER_COLUMN:
+                    columnHeader.dataSize = rows * sizeof(int64_t);
+                    break;
+                case ColumnarTable::REAL_COLUMN:
+                    columnHeader.dataSize = rows * sizeof(double);
+                    break;
+                case ColumnarTable::TEXT_COLUMN:
+                    columnHeader.offsetsOffset = align(offset);
+                    offset = columnHeader.offsetsOffset
+                        + (rows + 1) * sizeof(uint64_t);
+                    columnHeader.dataSize = column.text.size();
+                    break;
+            }
+
+            columnHeader.dataOffset = align(offset);
+            offset = columnHeader.dataOffset + columnHeader.dataSize;
+        }
+
+        header.fileSize = align(offset);
+
+        std::vector<IndexEntry> index(rows);
+        for (size_t row = 0; row < rows; ++row)
+        {
+            index[row].id = table.ids[row];
+            index[row].row = row;
+        }
+        std::sort(index.begin(), index.end());
+
+        std::ofstream out(path.c_str(),
+                std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out)
+            throw SnapshotError("Cannot create snapshot file '" + path + "'");
+
+        write(out, &header, sizeof(header));
+        if (!columns.empty())
+            write(out, &columns[0], columns.size() * sizeof(ColumnHeader));
+
+        pad(out, header.idsOffset);
+        if (rows > 0)
+            write(out, &table.ids[0], rows * sizeof(int64_t));
+
+        pad(out, header.indexOffset);
+        if (!index.empty())
+            write(out, &index[0], index.size() * sizeof(IndexEntry));
+
+        for (size_t i = 0; i < table.columns.size(); ++i)
+        {
+            const ColumnarTable::Column& column = table.columns[i];
+
+            switch (column.type)
+            {
+                case ColumnarTable::INTEGER_COLUMN:
+                    pad(out, columns[i].dataOffset);
+                    if (rows > 0)
+                        write(out, &column.integers[0],
+                              rows * sizeof(int64_t));
+                    break;
+                case ColumnarTable::REAL_COLUMN:
+                    pad(out, columns[i].dataOffset);
+                    if (rows > 0)
+                        write(out, &column.reals[0], rows * sizeof(double));
+                    break;
+                case ColumnarTable::TEXT_COLUMN:
+                    pad(out, columns[i].offsetsOffset);
+                    for (size_t row = 0; row <= rows; ++row)
+                    {
+                        uint64_t textOffset = column.offsets[row];
+                        write(out, &textOffset, sizeof(textOffset));
+                    }
+                    pad(out, columns[i].dataOffset);
+                    write(out, column.text.data(), column.text.size());
+                    break;
+            }
+        }
+
+        pad(out, header.fileSize);
+
+        out.close();
+        if (!out)
+            throw SnapshotError("Writing snapshot file '" + path
+                    + "' failed");
+    }
+
+private:
+    SnapshotWriter();
+
+    static void write(std::ofstream& out, const void* data, size_t size)
+    {
+        out.write(static_cast<const char*>(data),
+                  static_cast<std::streamsize>(size));
+    }
+
+    static void pad(std::ofstream& out, uint64_t offset)
+    {
+        static const char zeros[snapshot::ALIGNMENT] = { 0 };
+
+        uint64_t position = static_cast<uint64_t>(out.tellp());
+        if (position < offset)
+            write(out, zeros, static_cast<size_t>(offset - position));
+    }
+};
+
+/**
+ * Read-only view of a memory-mapped snapshot file. Column data is accessed
+ * in place, nothing is deserialized.
+ *
+ * The constructor checks the section bounds, text offsets and index rows,
+ * so that a truncated or corrupt file causes SnapshotError instead of
+ * reads outside the mapping.
+ */
+class MappedSnapshot
+{
+    UTILCPP_DISABLE_COPY(MappedSnapshot)
+
+public:
+    explicit MappedSnapshot(const std::string& path) :
+        _file(path),
+        _header(0),
+        _columns(0)
+    {
+        using namespace snapshot;
+
+        if (_file.size() < sizeof(Header))
+            invalid(path, "file is truncated");
+
+        _header = reinterpret_cast<const Header*>(_file.data());
+
+        if (std::memcmp(_header->magic, magic(), sizeof(_header->magic)))
+            invalid(path, "not a snapshot");
+        if (_header->version != FORMAT_VERSION)
+            invalid(path, "unsupported format version");
+        if (_header->fileSize != _file.size())
+            invalid(path, "file size does not match header");
+
+        _columns = reinterpret_cast<const ColumnHeader*>(
+                _file.data() + sizeof(Header));
+
+        const uint64_t rows = _header->rowCount;
+
+        // guards the section size computations below against overflow
+        if (rows >= _file.size() / sizeof(int64_t))
+            invalid(path, "row count is out of bounds");
+
+        checkRange(path, sizeof(Header),
+                   _header->columnCount * sizeof(ColumnHeader));
+        checkRange(path, _header->idsOffset, rows * sizeof(int64_t));
+        checkRange(path, _header->indexOffset, rows * sizeof(IndexEntry));
+
+        for (size_t i = 0; i < columnCount(); ++i)
+        {
+            const ColumnHeader& column = _columns[i];
+
+            if (column.label[LABEL_SIZE - 1] != '\0')
+                invalid(path, "column label is not terminated");
+
+            switch (column.type)
+            {
+                case ColumnarTable::INTEGER_COLUMN:
+                    checkRange(path, column.dataOffset,
+                               rows * sizeof(int64_t));
+                    break;
+                case ColumnarTable::REAL_COLUMN:
+                    checkRange(path, column.dataOffset,
+                               rows * sizeof(double));
+                    break;
+                case ColumnarTable::TEXT_COLUMN:
+                    checkRange(path, column.offsetsOffset,
+                               (rows + 1) * sizeof(uint64_t));
+                    checkRange(path, column.dataOffset, column.dataSize);
+                    checkTextOffsets(path, column);
+                    break;
+                default:
+                    invalid(path, "unknown column type");
+            }
+        }
+
+        checkIndex(path);
+    }
+
+    size_t size() const
+    { return static_cast<size_t>(_header->rowCount); }
+
+    size_t columnCount() const
+    { return _header->columnCount; }
+
+    std::string columnLabel(size_t column) const
+    { return _columns[column].label; }
+
+    ColumnarTable::ColumnType columnType(size_t column) const
+    { return static_cast<ColumnarTable::ColumnType>(_columns[column].type); }
+
+    size_t columnIndex(const std::string& label) const
+    {
+        for (size_t i = 0; i < columnCount(); ++i)
+            if (label == _columns[i].label)
+                return i;
+
+        throw SnapshotError("Snapshot has no column '" + label + "'");
+    }
+
+    const int64_t* ids() const
+    { return at<int64_t>(_header->idsOffset); }
+
+    const int64_t* integers(size_t column) const
+    {
+        checkType(column, ColumnarTable::INTEGER_COLUMN);
+        return at<int64_t>(_columns[column].dataOffset);
+    }
+
+    const double* reals(size_t column) const
+    {
+        checkType(column, ColumnarTable::REAL_COLUMN);
+        return at<double>(_columns[column].dataOffset);
+    }
+
+    const char* textData(size_t column, size_t row) const
+    {
+        checkType(column, ColumnarTable::TEXT_COLUMN);
+        return at<char>(_columns[column].dataOffset)
+            + textOffsets(column)[row];
+    }
+
+    size_t textLength(size_t column, size_t row) const
+    {
+        checkType(column, ColumnarTable::TEXT_COLUMN);
+        const uint64_t* offsets = textOffsets(column);
+        return static_cast<size_t>(offsets[row + 1] - offsets[row]);
+    }
+
+    /**
+     * Finds the row of the entity with the given id with a binary search
+     * over the id index.
+     */
+    bool findRow(int64_t id, size_t& row) const
+    {
+        const snapshot::IndexEntry* begin =
+            at<snapshot::IndexEntry>(_header->indexOffset);
+        const snapshot::IndexEntry* end = begin + size();
+
+        snapshot::IndexEntry key;
+        key.id = id;
+        key.row = 0;
+
+        const snapshot::IndexEntry* found = std::lower_bound(begin, end, key);
+        if (found == end || found->id != id)
+            return false;
+
+        row = static_cast<size_t>(found->row);
+        return true;
+    }
+
+    bool equals(size_t column, size_t row, int value) const
+    { return equals(column, row, static_cast<int64_t>(value)); }
+
+    bool equals(size_t column, size_t row, uint32_t value) const
+    { return equals(column, row, static_cast<int64_t>(value)); }
+
+    bool equals(size_t column, size_t row, uint64_t value) const
+    { return equals(column, row, static_cast<int64_t>(value)); }
+
+    bool equals(size_t column, size_t row, int64_t value) const
+    {
+        switch (columnType(column))
+        {
+            case ColumnarTable::INTEGER_COLUMN:
+                return integers(column)[row] == value;
+            case ColumnarTable::REAL_COLUMN:
+                return reals(column)[row] == static_cast<double>(value);
+            default:
+                return false;
+        }
+    }
+
+    bool equals(size_t column, size_t row, double value) const
+    {
+        switch (columnType(column))
+        {
+            case ColumnarTable::INTEGER_COLUMN:
+                return static_cast<double>(integers(column)[row]) == value;
+            case ColumnarTable::REAL_COLUMN:
+                return reals(column)[row] == value;
+            default:
+                return false;
+        }
+    }
+
+    bool equals(size_t column, size_t row, const char* value) const
+    {
+        return equals(column, row, value, std::strlen(value));
+    }
+
+    bool equals(size_t column, size_t row, const std::string& value) const
+    {
+        return equals(column, row, value.data(), value.size());
+    }
+
+    void read(size_t column, size_t row, int& value) const
+    { value = static_cast<int>(integers(column)[row]); }
+
+    void read(size_t column, size_t row, int64_t& value) const
+    { value = integers(column)[row]; }
+
+    void read(size_t column, size_t row, uint32_t& value) const
+    { value = static_cast<uint32_t>(integers(column)[row]); }
+
+    void read(size_t column, size_t row, uint64_t& value) const
+    { value = static_cast<uint64_t>(integers(column)[row]); }
+
+    void read(size_t column, size_t row, bool& value) const
+    { value = integers(column)[row] != 0; }
+
+    void read(size_t column, size_t row, double& value) const
+    { value = reals(column)[row]; }
+
+    void read(size_t column, size_t row, std::string& value) const
+    { value.assign(textData(column, row), textLength(column, row)); }
+
+private:
+    template <typename T>
+    const T* at(uint64_t offset) const
+    { return reinterpret_cast<const T*>(_file.data() + offset); }
+
+    const uint64_t* textOffsets(size_t column) const
+    { return at<uint64_t>(_columns[column].offsetsOffset); }
+
+    bool equals(size_t column, size_t row,
+                const char* value, size_t length) const
+    {
+        if (columnType(column) != ColumnarTable::TEXT_COLUMN)
+            return false;
+
+        return textLength(column, row) == length
+            && std::memcmp(textData(column, row), value, length) == 0;
+    }
+
+    void checkType(size_t column, ColumnarTable::ColumnType type) const
+    {
+        if (columnType(column) != type)
+            throw SnapshotError("Snapshot column '" + columnLabel(column)
+                    + "' has a different type");
+    }
+
+    void checkRange(const std::string& path,
+                    uint64_t offset, uint64_t size) const
+    {
+        if (offset % snapshot::ALIGNMENT != 0
+            || offset > _file.size() || size > _file.size() - offset)
+            invalid(path, "section is out of bounds");
+    }
+
+    // Text offsets must not decrease or point past the string heap.
+    void checkTextOffsets(const std::string& path,
+                          const snapshot::ColumnHeader& column) const
+    {
+        const uint64_t* offsets = at<uint64_t>(column.offsetsOffset);
+
+        if (offsets[0] != 0)
+            invalid(path, "text offsets do not start at zero");
+
+        for (uint64_t row = 0; row < _header->rowCount; ++row)
+            if (offsets[row + 1] < offsets[row])
+                invalid(path, "text offsets are not increasing");
+
+        if (offsets[_header->rowCount] > column.dataSize)
+            invalid(path, "text offsets point past the string heap");
+    }
+
+    void checkIndex(const std::string& path) const
+    {
+        const snapshot::IndexEntry* index =
+            at<snapshot::IndexEntry>(_header->indexOffset);
+
+        for (uint64_t i = 0; i < _header->rowCount; ++i)
+            if (index[i].row >= _header->rowCount)
+                invalid(path, "index entry row is out of bounds");
+    }
+
+    static void invalid(const std::string& path, const char* reason)
+    {
+        throw SnapshotError("Invalid snapshot file '" + path + "': "
+                + reason);
+    }
+
+    MappedFile _file;
+    const snapshot::Header* _header;
+    const snapshot::ColumnHeader* _columns;
+};
+
+class SnapshotFieldReader
+{
+    UTILCPP_DISABLE_COPY(SnapshotFieldReader)
+
+public:
+    SnapshotFieldReader(const MappedSnapshot& snapshot, size_t row) :
+        _snapshot(snapshot),
+        _row(row),
+        _column(0)
+    { }
+
+    template <typename T>
+    void visitField(const Field<T>& , T& field)
+    {
+        _snapshot.read(_column++, _row, field);
+    }
+
+    template <typename T>
+    void visitField(const Field<Lazy<T> >& , Lazy<T>& field)
+    {
+        T value;
+        _snapshot.read(_column++, _row, value);
+        field.set(value);
+    }
+
+    void visitField(const Field<Version>& , Version& field)
+    {
+        int64_t value = 0;
+        _snapshot.read(_column++, _row, value);
+        field.set(value);
+    }
+
+private:
+    const MappedSnapshot& _snapshot;
+    size_t _row;
+    size_t _column;
+};
+
+/**
+ * Read-only repository that serves entities from a memory-mapped snapshot
+ * file instead of the database.
+ *
+ * Snapshots are created with Export() from the table behind
+ * Repository<Entity, Mapping>. Lookups by id use the snapshot id index,
+ * field lookups scan the mapped column. Use snapshot() for direct column
+ * access without materializing entities.
+ */
+template <class Entity, class Mapping>
+class SnapshotRepository
+{
+    UTILCPP_DISABLE_COPY(SnapshotRepository)
+
+public:
+    typedef std::vector<Entity> Entities;
+    typedef typename Repository<Entity, Mapping>::Id Id;
+
+    static void Export(const std::string& path)
+    {
+        SnapshotWriter::Write(Repository<Entity, Mapping>::GetAllColumns(),
+                              path);
+    }
+
+    explicit SnapshotRepository(const std::string& path) :
+        _snapshot(path)
+    {
+        ColumnarTable expected;
+        Entity entity;
+
+        ColumnDeclarationCollector collector(expected);
+        Mapping::accept(collector, entity);
+
+        bool matches = expected.columns.size() == _snapshot.columnCount();
+        for (size_t i = 0; matches && i < expected.columns.size(); ++i)
+            matches = expected.columns[i].label == _snapshot.columnLabel(i)
+                && expected.columns[i].type == _snapshot.columnType(i);
+
+        if (!matches)
+            throw SnapshotError("Snapshot file '" + path + "' does not "
+                    "match mapping of " + Mapping::getLabel());
+    }
+
+    const MappedSnapshot& snapshot() const
+    { return _snapshot; }
+
+    size_t size() const
+    { return _snapshot.size(); }
+
+    Entity Get(Id id) const
+    {
+        size_t row = 0;
+        if (!_snapshot.findRow(id, row))
+        {
+            std::ostringstream msg;
+            msg << "No " << Mapping::getLabel() << " with ID " << id
+                << " exists in snapshot";
+            throw DoesNotExistError(msg.str());
+        }
+
+        return GetAt(row);
+    }
+
+    template <typename Value>
+    Entity GetByField(const std::string& fieldname, const Value& value,
+            bool allowMany = false) const
+    {
+        std::vector<size_t> rows = FindRows(fieldname, value,
+                                            allowMany ? 1 : 2);
+        if (rows.empty())
+            throw DoesNotExistError("No " + Mapping::getLabel()
+                    + " exists in snapshot for field '" + fieldname + "'");
+        if (rows.size() > 1)
+            throw NotOneError("More than one result in snapshot for "
+                    "field '" + fieldname + "'");
+
+        return GetAt(rows.front());
+    }
+
+    template <typename Value>
+    Entities GetManyByField(const std::string& fieldname,
+            const Value& value) const
+    {
+        std::vector<size_t> rows = FindRows(fieldname, value, size());
+
+        Entities entities(rows.size());
+        for (size_t i = 0; i < rows.size(); ++i)
+            Fill(rows[i], entities[i]);
+
+        return entities;
+    }
+
+    Entities GetAll() const
+    {
+        Entities entities(size());
+        for (size_t row = 0; row < entities.size(); ++row)
+            Fill(row, entities[row]);
+
+        return entities;
+    }
+
+    Entity GetAt(size_t row) const
+    {
+        Entity entity;
+        Fill(row, entity);
+        return entity;
+    }
+
+private:
+    void Fill(size_t row, Entity& entity) const
+    {
+        entity.id = static_cast<Id>(_snapshot.ids()[row]);
+
+        SnapshotFieldReader reader(_snapshot, row);
+        Mapping::accept(reader, entity);
+    }
+
+    template <typename Value>
+    std::vector<size_t> FindRows(const std::string& fieldname,
+            const Value& value, size_t limit) const
+    {
+        const size_t column = _snapshot.columnIndex(fieldname);
+
+        std::vector<size_t> rows;
+        for (size_t row = 0; row < size() && rows.size() < limit; ++row)
+            if (_snapshot.equals(column, row, value))
+                rows.push_back(row);
+
+        return rows;
+    }
+
+    MappedSnapshot _snapshot;
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_SNAPSHOT_H__ */
@@ -0,0 +1,143 @@
+#ifndef DATAMAPPERCPP_SQLITEBACKEND_H__
+#define DATAMAPPERCPP_SQLITEBACKEND_H__
+
+#include <datamappercpp/sql/exceptions.h>
+
+#include <datamappercpp/sql/detail/Backend.h>
+#include <datamappercpp/sql/detail/SqliteHandle.h>
+
+#include <utilcpp/disable_copy.h>
+
+#include <climits>
+#include <sstream>
+#include <string>
+
+namespace dm {
+namespace sql {
+
+class SqliteBlob : public BlobHandle
+{
+    UTILCPP_DISABLE_COPY(SqliteBlob)
+
+public:
+    SqliteBlob(const std::string& schema, const std::string& table,
+               const std::string& column, int64_t id, bool writable) :
+        _db(SqliteHandle::get()),
+        _blob(0)
+    {
+        int rc = sqlite3_blob_open(_db, schema.c_str(), table.c_str(),
+                column.c_str(), id, writable ? 1 : 0, &_blob);
+        if (rc != SQLITE_OK)
+        {
+            std::ostringstream msg;
+            msg << "Cannot open blob " << schema << "." << table << "."
+                << column << " of ID " << id << ": " << sqlite3_errmsg(_db);
+            // the handle is allocated even on failure
+            sqlite3_blob_close(_blob);
+            throw BlobError(msg.str());
+        }
+    }
+
+    ~SqliteBlob()
+    {
+        sqlite3_blob_close(_blob);
+    }
+
+    size_t size() const
+    { return static_cast<size_t>(sqlite3_blob_bytes(_blob)); }
+
+    void read(void* buffer, size_t size, size_t offset) const
+    {
+        check(sqlite3_blob_read(_blob, buffer, toInt(size, "size"),
+                                toInt(offset, "offset")), "read");
+    }
+
+    void write(const void* data, size_t size, size_t offset)
+    {
+        check(sqlite3_blob_write(_blob, data, toInt(size, "size"),
+                                 toInt(offset, "offset")), "write");
+    }
+
+private:
+    // SQLite takes blob sizes and offsets as int
+    static int toInt(size_t value, const char* what)
+    {
+        if (value > static_cast<size_t>(INT_MAX))
+        {
+            std::ostringstream msg;
+            msg << "Blob " << what << " " << value << " exceeds INT_MAX";
+            throw BlobError(msg.str());
+        }
+        return static_cast<int>(value);
+    }
+
+    void check(int rc, const char* operation) const
+    {
+        if (rc != SQLITE_OK)
+            throw BlobError(std::string("Blob ") + operation + " failed: "
+                    + sqlite3_errmsg(_db));
+    }
+
+    sqlite3* _db;
+    sqlite3_blob* _blob;
+};
+
+/**
+ * The Backend of dbc-cpp SQLite connections. Including this header in any
+ * translation unit installs it, usually next to ConnectDatabase():
+ *
+ *   #include <datamappercpp/sql/SqliteBackend.h>
+ */
+class SqliteBackend : public Backend
+{
+public:
+    static SqliteBackend& instance()
+    {
+        static SqliteBackend backend;
+        return backend;
+    }
+
+    int64_t lastInsertId()
+    { return SqliteHandle::lastInsertId(); }
+
+    bool inTransaction()
+    { return !sqlite3_get_autocommit(SqliteHandle::get()); }
+
+    const TransactionOutcomePtr& transactionOutcome()
+    { return SqliteHandle::transactionOutcome(); }
+
+    void addRollbackListener(RollbackListener listener)
+    { SqliteHandle::addRollbackListener(listener); }
+
+    void commitFailed()
+    { SqliteHandle::commitFailed(); }
+
+    BlobHandle* openBlob(const std::string& schema, const std::string& table,
+                         const std::string& column, int64_t id,
+                         bool writable)
+    { return new SqliteBlob(schema, table, column, id, writable); }
+
+private:
+    SqliteBackend()
+    { }
+};
+
+namespace detail
+{
+
+struct SqliteBackendInstaller
+{
+    SqliteBackendInstaller()
+    {
+        Backend::install(SqliteBackend::instance());
+    }
+};
+
+// one per translation unit, installing the same backend is harmless
+static SqliteBackendInstaller sqliteBackendInstaller;
+
+}
+
+} }
+
+#endif /* DATAMAPPERCPP_SQLITEBACKEND_H__ */
@@ -1,7 +1,11 @@
 #ifndef DATAMAPPERCPP_TRANSACTION_H__
 #define DATAMAPPERCPP_TRANSACTION_H__
 
+#include <datamappercpp/sql/ChangeFeed.h>
 #include <datamappercpp/sql/db.h>
+#include <datamappercpp/sql/exceptions.h>
+
+#include <datamappercpp/sql/detail/Backend.h>
 
 namespace dm {
 namespace sql {
@@ -13,9 +17,17 @@ public:
         _is_enabled(enabled),
         _is_completed(false)
     {
-        if (_is_enabled)
-            // TODO: default isolation level
-            ExecuteStatement("BEGIN TRANSACTION");
+        if (!_is_enabled)
+            return;
+
+        // SQLite would fail BEGIN with a generic error
+        if (Backend::instance().inTransaction())
+            throw NestedTransactionError("Transaction opened inside another "
+                    "transaction, pass enableTransaction = false to "
+                    "repository calls in transactions");
+
+        // TODO: default isolation level
+        ExecuteStatement("BEGIN TRANSACTION");
     }
 
     void commit()
@@ -24,6 +36,8 @@ public:
         {
             do_commit();
             _is_completed = true;
+
+            ChangeFeed::publish();
         }
     }
 
@@ -45,10 +59,25 @@ public:
 
 private:
     void do_commit()
-    { ExecuteStatement("COMMIT TRANSACTION"); }
+    {
+        try
+        {
+            ExecuteStatement("COMMIT TRANSACTION");
+        }
+        catch (...)
+        {
+            Backend& backend = Backend::instance();
+            if (backend.inTransaction())
+                backend.commitFailed();
+            throw;
+        }
+    }
 
     void do_rollback()
-    { ExecuteStatement("ROLLBACK TRANSACTION"); }
+    {
+        ChangeFeed::discard();
+        ExecuteStatement("ROLLBACK TRANSACTION");
+    }
 
     bool _is_enabled;
     bool _is_completed;
@@ -1,6 +1,9 @@
 #ifndef DATAMAPPERCPP_DB_H__
 #define DATAMAPPERCPP_DB_H__
 
+#include <datamappercpp/sql/detail/Backend.h>
+#include <datamappercpp/sql/detail/QueryPlanChecker.h>
+
 #include <dbccpp/dbccpp.h>
 
 #include <string>
@@ -13,6 +16,7 @@ typedef dbc::PreparedStatement::ptr Statement;
 void ConnectDatabase(const std::string& dbFileName)
 {
     dbc::DbConnection::connect("sqlite", dbFileName);
+    Backend::connectionChanged();
 }
 
 void ExecuteStatement(const std::string& sql)
@@ -22,7 +26,16 @@ void ExecuteStatement(const std::string& sql)
 
 Statement PrepareStatement(const std::string& sql)
 {
-    return dbc::DbConnection::instance().prepareStatement(sql);
+    Statement statement = dbc::DbConnection::instance().prepareStatement(sql);
+    QueryPlanChecker::check(sql);
+    return statement;
+}
+
+// Diagnostics for newly prepared statements that scan whole tables of at
+// least minTableRows rows, see QueryPlanChecker.
+void SetQueryPlanCheck(QueryPlanCheck mode, size_t minTableRows = 1000)
+{
+    QueryPlanChecker::configure(mode, minTableRows);
 }
 
 } }
@@ -0,0 +1,119 @@
+#ifndef DATAMAPPERCPP_BACKEND_H__
+#define DATAMAPPERCPP_BACKEND_H__
+
+#include <datamappercpp/sql/exceptions.h>
+
+#include <datamappercpp/Version.h>
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <string>
+
+namespace dm {
+namespace sql {
+
+/**
+ * A single blob value opened for incremental I/O by Backend::openBlob(),
+ * see BlobStream. Failures throw BlobError.
+ */
+class BlobHandle
+{
+public:
+    virtual ~BlobHandle()
+    { }
+
+    virtual size_t size() const = 0;
+    virtual void read(void* buffer, size_t size, size_t offset) const = 0;
+    virtual void write(const void* data, size_t size, size_t offset) = 0;
+};
+
+/**
+ * Database operations that dbc-cpp does not wrap, which Repository,
+ * Transaction, ChangeFeed and BlobStream need.
+ *
+ * The headers on the Repository.h include path only use this interface,
+ * so that they do not depend on sqlite3.h or dbc-cpp internals. The SQLite
+ * implementation installs itself when <datamappercpp/sql/SqliteBackend.h>
+ * is included in any translation unit of the program.
+ */
+class Backend
+{
+public:
+    typedef void (*RollbackListener)();
+
+    virtual ~Backend()
+    { }
+
+    // dbc-cpp PreparedStatement::getLastInsertId() is limited to int
+    virtual int64_t lastInsertId() = 0;
+
+    // whether a transaction is open on the connection
+    virtual bool inTransaction() = 0;
+
+    /**
+     * Outcome of the open transaction of the connection, resolved on
+     * commit or rollback, also of rollbacks that Transaction does not
+     * manage.
+     */
+    virtual const TransactionOutcomePtr& transactionOutcome() = 0;
+
+    // Calls listener on every rollback of the connection.
+    virtual void addRollbackListener(RollbackListener listener) = 0;
+
+    // Called by Transaction when COMMIT failed but left the transaction
+    // open, e.g. when the database was busy.
+    virtual void commitFailed() = 0;
+
+    // The caller owns the returned handle.
+    virtual BlobHandle* openBlob(const std::string& schema,
+                                 const std::string& table,
+                                 const std::string& column,
+                                 int64_t id, bool writable) = 0;
+
+    static Backend& instance()
+    {
+        Backend* backend = installed();
+        if (!backend)
+            throw BackendError("No database backend is installed, include "
+                    "<datamappercpp/sql/SqliteBackend.h>");
+        return *backend;
+    }
+
+    static void install(Backend& backend)
+    {
+        installed() = &backend;
+    }
+
+    /**
+     * Incremented by ConnectDatabase(), so that backends can drop state
+     * that belongs to the previous connection, e.g. a cached native
+     * handle.
+     */
+    static unsigned connectionGeneration()
+    {
+        return generation();
+    }
+
+    static void connectionChanged()
+    {
+        ++generation();
+    }
+
+private:
+    static Backend*& installed()
+    {
+        static Backend* backend = 0;
+        return backend;
+    }
+
+    static unsigned& generation()
+    {
+        static unsigned g = 0;
+        return g;
+    }
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_BACKEND_H__ */
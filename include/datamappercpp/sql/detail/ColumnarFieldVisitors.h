@@ -0,0 +1,227 @@
+#ifndef DATAMAPPERCPP_COLUMNARFIELDVISITORS_H__
+#define DATAMAPPERCPP_COLUMNARFIELDVISITORS_H__
+
+#include <datamappercpp/sql/detail/ValueCodec.h>
+
+#include <datamappercpp/ColumnarTable.h>
+#include <datamappercpp/Field.h>
+#include <datamappercpp/Lazy.h>
+#include <datamappercpp/Version.h>
+
+#include <dbccpp/dbccpp.h>
+
+#include <utilcpp/disable_copy.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace dm {
+namespace sql {
+
+class ColumnDeclarationCollector
+{
+    UTILCPP_DISABLE_COPY(ColumnDeclarationCollector)
+
+public:
+    ColumnDeclarationCollector(ColumnarTable& table) :
+        _table(table)
+    { }
+
+    template <typename T>
+    void visitField(const Field<T>& field, const T& )
+    {
+        _table.columns.push_back(ColumnarTable::Column(field.label,
+                    detail::ColumnTraits<T>::type));
+    }
+
+    template <typename T>
+    void visitField(const Field<Lazy<T> >& field, const Lazy<T>& )
+    {
+        _table.columns.push_back(ColumnarTable::Column(field.label,
+                    detail::ColumnTraits<T>::type));
+    }
+
+    void visitField(const Field<Version>& field, const Version& )
+    {
+        _table.columns.push_back(ColumnarTable::Column(field.label,
+                    ColumnarTable::INTEGER_COLUMN));
+    }
+
+private:
+    ColumnarTable& _table;
+};
+
+class ColumnFiller
+{
+    UTILCPP_DISABLE_COPY(ColumnFiller)
+
+public:
+    ColumnFiller(ColumnarTable& table, const dbc::ResultSet& result) :
+        _table(table),
+        _result(result),
+        _column(0)
+    { }
+
+    template <typename T>
+    void visitField(const Field<T>& , const T& )
+    {
+        // result column 0 is id, hence the + 1
+        detail::ColumnTraits<T>::append(_table.columns[_column],
+                ValueCodec<T>::read(_result, static_cast<int>(_column + 1)));
+        ++_column;
+    }
+
+    // lazy columns are exported eagerly
+    template <typename T>
+    void visitField(const Field<Lazy<T> >& field, const Lazy<T>& )
+    {
+        visitField(Field<T>(field.label), T());
+    }
+
+    void visitField(const Field<Version>& field, const Version& )
+    {
+        visitField(Field<int64_t>(field.label), int64_t());
+    }
+
+private:
+    ColumnarTable& _table;
+    const dbc::ResultSet& _result;
+    size_t _column;
+};
+
+/**
+ * Checks that the columns of a table that is about to be inserted have the
+ * types of the mapped fields and rows values each, as ColumnBinder reads
+ * them unchecked.
+ */
+class ColumnValidator
+{
+    UTILCPP_DISABLE_COPY(ColumnValidator)
+
+public:
+    ColumnValidator(const ColumnarTable& table, size_t rows) :
+        _table(table),
+        _rows(rows),
+        _column(0)
+    { }
+
+    template <typename T>
+    void visitField(const Field<T>& field, const T& )
+    {
+        check(field.label, detail::ColumnTraits<T>::type);
+    }
+
+    template <typename T>
+    void visitField(const Field<Lazy<T> >& field, const Lazy<T>& )
+    {
+        check(field.label, detail::ColumnTraits<T>::type);
+    }
+
+    void visitField(const Field<Version>& field, const Version& )
+    {
+        check(field.label, ColumnarTable::INTEGER_COLUMN);
+    }
+
+    static size_t RowCount(const ColumnarTable::Column& column)
+    {
+        switch (column.type)
+        {
+            case ColumnarTable::INTEGER_COLUMN:
+                return column.integers.size();
+            case ColumnarTable::REAL_COLUMN:
+                return column.reals.size();
+            case ColumnarTable::TEXT_COLUMN:
+                return column.offsets.empty() ? 0 : column.offsets.size() - 1;
+        }
+        return 0; // unreachable
+    }
+
+private:
+    void check(const std::string& label, ColumnarTable::ColumnType type)
+    {
+        const ColumnarTable::Column& column = _table.columns[_column++];
+
+        if (column.type != type)
+            throw std::invalid_argument("Type of column '" + column.label
+                    + "' does not match mapped field '" + label + "'");
+
+        if (RowCount(column) != _rows)
+            throw std::invalid_argument("Column '" + column.label
+                    + "' does not have as many rows as the first column");
+
+        if (type == ColumnarTable::TEXT_COLUMN && !ValidOffsets(column))
+            throw std::invalid_argument("Offsets of column '" + column.label
+                    + "' are not ascending offsets into its text");
+    }
+
+    // Offsets start at 0, do not decrease and end within the text, so
+    // that every row is a range of the text.
+    static bool ValidOffsets(const ColumnarTable::Column& column)
+    {
+        const std::vector<size_t>& offsets = column.offsets;
+
+        if (offsets.empty() || offsets.front() != 0
+                || offsets.back() > column.text.size())
+            return false;
+
+        for (size_t i = 1; i < offsets.size(); ++i)
+            if (offsets[i] < offsets[i - 1])
+                return false;
+
+        return true;
+    }
+
+    const ColumnarTable& _table;
+    size_t _rows;
+    size_t _column;
+};
+
+class ColumnBinder
+{
+    UTILCPP_DISABLE_COPY(ColumnBinder)
+
+public:
+    ColumnBinder(const ColumnarTable& table,
+                 dbc::PreparedStatement::ptr& statement) :
+        _table(table),
+        _statement(statement),
+        _row(0),
+        _column(0)
+    { }
+
+    void setRow(size_t row)
+    {
+        _row = row;
+        _column = 0;
+    }
+
+    template <typename T>
+    void visitField(const Field<T>& , const T& )
+    {
+        ValueCodec<T>::bind(_statement,
+                detail::ColumnTraits<T>::at(_table.columns[_column++], _row));
+    }
+
+    template <typename T>
+    void visitField(const Field<Lazy<T> >& field, const Lazy<T>& )
+    {
+        visitField(Field<T>(field.label), T());
+    }
+
+    // inserted rows start at version 1, see InsertStatementFieldBuilder
+    void visitField(const Field<Version>& , const Version& )
+    {
+        ++_column;
+    }
+
+private:
+    const ColumnarTable& _table;
+    dbc::PreparedStatement::ptr& _statement;
+    size_t _row;
+    size_t _column;
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_COLUMNARFIELDVISITORS_H__ */
@@ -0,0 +1,126 @@
+#ifndef DATAMAPPERCPP_DBWORKER_H__
+#define DATAMAPPERCPP_DBWORKER_H__
+
+#if !defined(__GXX_EXPERIMENTAL_CXX0X__) && (__cplusplus <= 199711L)
+  #error "The asynchronous repository API requires C++11"
+#endif
+
+#include <utilcpp/disable_copy.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace dm {
+namespace sql {
+
+/**
+ * Thread that runs database jobs one at a time, in submission order. The
+ * connection is only used by one job at a time, so jobs never interleave
+ * inside each other's transactions.
+ *
+ * Completions of jobs are handed to the completion executor. Without one
+ * they run directly on the worker thread; event loops install an executor
+ * that posts them to the loop instead. Completions must not throw.
+ */
+class DbWorker
+{
+    UTILCPP_DISABLE_COPY(DbWorker)
+
+public:
+    typedef std::function<void ()> Job;
+    typedef std::function<void (Job)> Executor;
+
+    static DbWorker& instance()
+    {
+        static DbWorker worker;
+        return worker;
+    }
+
+    void submit(Job job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.push_back(std::move(job));
+        }
+        _wakeup.notify_one();
+    }
+
+    void complete(Job completion)
+    {
+        Executor executor;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            executor = _executor;
+        }
+
+        if (executor)
+            executor(std::move(completion));
+        else
+            completion();
+    }
+
+    void setCompletionExecutor(Executor executor)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _executor = std::move(executor);
+    }
+
+    ~DbWorker()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _wakeup.notify_one();
+
+        // jobs that were already submitted are still run
+        _thread.join();
+    }
+
+private:
+    DbWorker() :
+        _jobs(),
+        _executor(),
+        _stopping(false),
+        _mutex(),
+        _wakeup(),
+        _thread(&DbWorker::run, this)
+    { }
+
+    void run()
+    {
+        for (;;)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                while (_jobs.empty() && !_stopping)
+                    _wakeup.wait(lock);
+
+                if (_jobs.empty())
+                    return;
+
+                job = std::move(_jobs.front());
+                _jobs.pop_front();
+            }
+
+            job();
+        }
+    }
+
+    std::deque<Job> _jobs;
+    Executor _executor;
+    bool _stopping;
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    // last, started after the other members are initialized
+    std::thread _thread;
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_DBWORKER_H__ */
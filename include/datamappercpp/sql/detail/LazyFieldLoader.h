@@ -0,0 +1,139 @@
+#ifndef DATAMAPPERCPP_LAZYFIELDLOADER_H__
+#define DATAMAPPERCPP_LAZYFIELDLOADER_H__
+
+#include <datamappercpp/sql/BlobStream.h>
+#include <datamappercpp/sql/db.h>
+#include <datamappercpp/sql/exceptions.h>
+#include <datamappercpp/sql/detail/ValueCodec.h>
+
+#include <datamappercpp/Blob.h>
+
+#include <dbccpp/dbccpp.h>
+
+#include <stdint.h>
+
+#include <map>
+#include <sstream>
+#include <string>
+
+namespace dm {
+namespace sql {
+
+/**
+ * Prepared statements for loading single lazy columns by id, shared by all
+ * repositories and keyed by table and column.
+ */
+class LazyStatements
+{
+public:
+    static Statement& get(const std::string& table, const std::string& label)
+    {
+        Statement& statement = statements()[table + "." + label];
+
+        if (!statement)
+        {
+            std::ostringstream sql;
+            sql << "SELECT " << label << " FROM " << table << " WHERE id=?";
+            statement = PrepareStatement(sql.str());
+        }
+        else
+        {
+            statement->reset();
+            statement->clear();
+        }
+
+        return statement;
+    }
+
+    static void reset(const std::string& table)
+    {
+        const std::string prefix = table + ".";
+        Map& map = statements();
+
+        for (Map::iterator it = map.begin(); it != map.end(); )
+        {
+            if (it->first.compare(0, prefix.size(), prefix) == 0)
+                map.erase(it++);
+            else
+                ++it;
+        }
+    }
+
+private:
+    typedef std::map<std::string, Statement> Map;
+
+    LazyStatements();
+
+    static Map& statements()
+    {
+        static Map map;
+        return map;
+    }
+};
+
+/**
+ * Loader that Lazy<T> fields of loaded entities call on first access.
+ */
+template <typename T>
+class LazyFieldLoader
+{
+public:
+    LazyFieldLoader(const std::string& table, const std::string& label,
+                    int64_t id) :
+        _table(table), _label(label), _id(id)
+    { }
+
+    T operator()() const
+    {
+        Statement& statement = LazyStatements::get(_table, _label);
+        ValueCodec<int64_t>::bind(statement, _id);
+
+        dbc::ResultSet::ptr result(statement->executeQuery());
+        if (!result->next())
+        {
+            std::ostringstream msg;
+            msg << "No " << _table << " with ID " << _id
+                << " exists for loading lazy field '" << _label << "'";
+            throw DoesNotExistError(msg.str());
+        }
+
+        T value = ValueCodec<T>::read(*result, 0);
+
+        // release the read lock of the shared statement right away
+        statement->reset();
+
+        return value;
+    }
+
+private:
+    std::string _table;
+    std::string _label;
+    int64_t _id;
+};
+
+// Blobs are read with incremental I/O instead of through the result set.
+template <>
+class LazyFieldLoader<Blob>
+{
+public:
+    LazyFieldLoader(const std::string& table, const std::string& label,
+                    int64_t id) :
+        _table(table), _label(label), _id(id)
+    { }
+
+    Blob operator()() const
+    {
+        Blob value;
+        BlobStream::Read(_table, _label, _id, value);
+        return value;
+    }
+
+private:
+    std::string _table;
+    std::string _label;
+    int64_t _id;
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_LAZYFIELDLOADER_H__ */
@@ -0,0 +1,117 @@
+#ifndef DATAMAPPERCPP_MAPPEDFILE_H__
+#define DATAMAPPERCPP_MAPPEDFILE_H__
+
+#include <datamappercpp/sql/exceptions.h>
+
+#include <utilcpp/disable_copy.h>
+
+#include <string>
+#include <cstddef>
+
+#ifdef _WIN32
+  #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+  #endif
+  #include <windows.h>
+#else
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+namespace dm {
+namespace sql {
+
+/**
+ * Read-only memory mapping of a whole file.
+ */
+class MappedFile
+{
+    UTILCPP_DISABLE_COPY(MappedFile)
+
+public:
+    explicit MappedFile(const std::string& path) :
+        _data(0),
+        _size(0)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ,
+                FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            fail("Cannot open", path);
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+        {
+            CloseHandle(file);
+            fail("Cannot map empty or unreadable", path);
+        }
+
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY,
+                0, 0, NULL);
+        CloseHandle(file);
+        if (mapping == NULL)
+            fail("Cannot map", path);
+
+        _data = static_cast<const char*>(
+                MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        CloseHandle(mapping);
+        if (_data == NULL)
+            fail("Cannot map", path);
+
+        _size = static_cast<size_t>(size.QuadPart);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            fail("Cannot open", path);
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            ::close(fd);
+            fail("Cannot map empty or unreadable", path);
+        }
+
+        void* data = ::mmap(0, static_cast<size_t>(st.st_size), PROT_READ,
+                MAP_SHARED, fd, 0);
+        // the mapping stays valid after the descriptor is closed
+        ::close(fd);
+        if (data == MAP_FAILED)
+            fail("Cannot map", path);
+
+        _data = static_cast<const char*>(data);
+        _size = static_cast<size_t>(st.st_size);
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(_data);
+#else
+        ::munmap(const_cast<char*>(_data), _size);
+#endif
+    }
+
+    const char* data() const
+    { return _data; }
+
+    size_t size() const
+    { return _size; }
+
+private:
+    static void fail(const char* what, const std::string& path)
+    {
+        throw SnapshotError(std::string(what) + " snapshot file '"
+                + path + "'");
+    }
+
+    const char* _data;
+    size_t _size;
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_MAPPEDFILE_H__ */
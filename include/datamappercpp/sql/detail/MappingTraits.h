@@ -0,0 +1,91 @@
+#ifndef DATAMAPPERCPP_MAPPINGTRAITS_H__
+#define DATAMAPPERCPP_MAPPINGTRAITS_H__
+
+#include <datamappercpp/Index.h>
+
+#include <stdint.h>
+
+namespace dm {
+namespace sql {
+
+/**
+ * Detects whether Mapping declares a typedef named id_type.
+ */
+template <class Mapping>
+class HasIdType
+{
+    typedef char yes;
+    typedef char (&no)[2];
+
+    template <class U>
+    static yes test(typename U::id_type*);
+
+    template <class U>
+    static no test(...);
+
+public:
+    static const bool value = sizeof(test<Mapping>(0)) == sizeof(yes);
+};
+
+/**
+ * Entity id type of a mapping: Mapping::id_type when declared, int64_t
+ * otherwise.
+ */
+template <class Mapping, bool declared = HasIdType<Mapping>::value>
+struct IdTypeOf
+{
+    typedef int64_t type;
+};
+
+template <class Mapping>
+struct IdTypeOf<Mapping, true>
+{
+    typedef typename Mapping::id_type type;
+};
+
+/**
+ * Detects whether Mapping declares static void declareIndexes(Indexes&).
+ */
+template <class Mapping>
+class HasIndexDeclarations
+{
+    typedef char yes;
+    typedef char (&no)[2];
+
+    template <typename Signature, Signature>
+    struct Check;
+
+    template <class U>
+    static yes test(Check<void (*)(Indexes&), &U::declareIndexes>*);
+
+    template <class U>
+    static no test(...);
+
+public:
+    static const bool value = sizeof(test<Mapping>(0)) == sizeof(yes);
+};
+
+/**
+ * Indexes declared by a mapping, none if it does not declare any.
+ */
+template <class Mapping, bool declared = HasIndexDeclarations<Mapping>::value>
+struct IndexesOf
+{
+    static Indexes get()
+    { return Indexes(); }
+};
+
+template <class Mapping>
+struct IndexesOf<Mapping, true>
+{
+    static Indexes get()
+    {
+        Indexes indexes;
+        Mapping::declareIndexes(indexes);
+        return indexes;
+    }
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_MAPPINGTRAITS_H__ */
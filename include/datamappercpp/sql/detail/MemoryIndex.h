@@ -0,0 +1,622 @@
+#ifndef DATAMAPPERCPP_MEMORYINDEX_H__
+#define DATAMAPPERCPP_MEMORYINDEX_H__
+
+#include <datamappercpp/sql/detail/MappingTraits.h>
+#include <datamappercpp/sql/detail/stdutil.h>
+
+#include <datamappercpp/Blob.h>
+#include <datamappercpp/Field.h>
+#include <datamappercpp/Lazy.h>
+#include <datamappercpp/Version.h>
+
+#include <utilcpp/disable_copy.h>
+#include <utilcpp/release_assert.h>
+
+#include <stdint.h>
+
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace dm {
+namespace sql {
+
+enum MemoryIndexType
+{
+    // equality lookups through a hash table
+    HASH_INDEX,
+    // equality and range lookups through an ordered tree
+    SORTED_INDEX
+};
+
+/**
+ * Field value used as an in-memory index key.
+ *
+ * Integers and reals are compared numerically like SQLite does, so 32 and
+ * 32.0 are the same key. Numbers order before text. Keys of lookups are
+ * converted by the affinity of the field with asText() and asNumber()
+ * first, as SQLite converts values compared with a column.
+ */
+class IndexKey
+{
+public:
+    IndexKey() :
+        _kind(INTEGER), _integer(0), _real(0.0), _text(), _fromReal(false)
+    { }
+
+    IndexKey(int value) :
+        _kind(INTEGER), _integer(value), _real(value), _text(),
+        _fromReal(false)
+    { }
+
+    IndexKey(int64_t value) :
+        _kind(INTEGER), _integer(value), _real(static_cast<double>(value)),
+        _text(), _fromReal(false)
+    { }
+
+    IndexKey(uint32_t value) :
+        _kind(INTEGER), _integer(value), _real(value), _text(),
+        _fromReal(false)
+    { }
+
+    // ordered by the signed value, as stored in the database
+    IndexKey(uint64_t value) :
+        _kind(INTEGER), _integer(static_cast<int64_t>(value)),
+        _real(static_cast<double>(_integer)), _text(), _fromReal(false)
+    { }
+
+    IndexKey(bool value) :
+        _kind(INTEGER), _integer(value ? 1 : 0), _real(value ? 1 : 0),
+        _text(), _fromReal(false)
+    { }
+
+    IndexKey(double value) :
+        _kind(REAL), _integer(0), _real(value), _text(), _fromReal(true)
+    {
+        // whole reals are stored as integers to hash equal to them
+        if (value > -9.2e18 && value < 9.2e18)
+        {
+            int64_t integer = static_cast<int64_t>(value);
+            if (static_cast<double>(integer) == value)
+            {
+                _kind = INTEGER;
+                _integer = integer;
+            }
+        }
+    }
+
+    IndexKey(const std::string& value) :
+        _kind(TEXT), _integer(0), _real(0.0), _text(value), _fromReal(false)
+    { }
+
+    IndexKey(const char* value) :
+        _kind(TEXT), _integer(0), _real(0.0), _text(value), _fromReal(false)
+    { }
+
+    // Numbers as the text SQLite compares a TEXT column with, reals as
+    // printed by SQLite with at least one decimal, e.g. 2.0.
+    IndexKey asText() const
+    {
+        if (isText())
+            return *this;
+
+        std::ostringstream text;
+        if (!_fromReal)
+        {
+            text << _integer;
+            return IndexKey(text.str());
+        }
+
+        text.precision(15);
+        text << _real;
+        std::string printed = text.str();
+        if (printed.find_first_of(".ein") == std::string::npos)
+            printed += ".0";
+        else if (printed.find('.') == std::string::npos
+                 && printed.find('e') != std::string::npos)
+            printed.insert(printed.find('e'), ".0");
+        return IndexKey(printed);
+    }
+
+    // Text that is an integer or real literal as the number, as SQLite
+    // compares a numeric column with it, other keys as they are.
+    IndexKey asNumber() const
+    {
+        if (!isText() || _text.empty()
+                || _text.find_first_not_of(" +-.0123456789eE")
+                    != std::string::npos)
+            return *this;
+
+        const char* begin = _text.c_str();
+        const char* end = begin + _text.size();
+        while (end > begin && end[-1] == ' ')
+            --end;
+
+        char* parsed = 0;
+        errno = 0;
+        const long long integer = std::strtoll(begin, &parsed, 10);
+        if (parsed == end && errno != ERANGE)
+            return IndexKey(static_cast<int64_t>(integer));
+
+        const double real = std::strtod(begin, &parsed);
+        if (parsed == end && parsed != begin)
+            return IndexKey(real);
+
+        return *this;
+    }
+
+    bool operator==(const IndexKey& rhs) const
+    {
+        if (isText() || rhs.isText())
+            return isText() && rhs.isText() && _text == rhs._text;
+        if (_kind == INTEGER && rhs._kind == INTEGER)
+            return _integer == rhs._integer;
+        return _real == rhs._real;
+    }
+
+    bool operator<(const IndexKey& rhs) const
+    {
+        if (isText() || rhs.isText())
+            return isText() ? (rhs.isText() && _text < rhs._text) : true;
+        if (_kind == INTEGER && rhs._kind == INTEGER)
+            return _integer < rhs._integer;
+        return _real < rhs._real;
+    }
+
+    size_t hash() const
+    {
+        if (isText())
+            return stdutil::hash<std::string>()(_text);
+        if (_kind == INTEGER)
+            return stdutil::hash<int64_t>()(_integer);
+        return stdutil::hash<double>()(_real);
+    }
+
+private:
+    enum Kind { INTEGER, REAL, TEXT };
+
+    bool isText() const
+    { return _kind == TEXT; }
+
+    Kind _kind;
+    int64_t _integer;
+    double _real;
+    std::string _text;
+    // whole reals are INTEGER keys, but print as reals
+    bool _fromReal;
+};
+
+struct IndexKeyHash
+{
+    size_t operator()(const IndexKey& key) const
+    { return key.hash(); }
+};
+
+class IndexKeyExtractor
+{
+    UTILCPP_DISABLE_COPY(IndexKeyExtractor)
+
+public:
+    IndexKeyExtractor(const std::string& label) :
+        _label(label), _key(), _found(false)
+    { }
+
+    template <typename T>
+    void visitField(const Field<T>& field, const T& value)
+    {
+        if (!_found && field.label == _label)
+        {
+            _key = IndexKey(value);
+            _found = true;
+        }
+    }
+
+    // lazy fields are not cached and cannot be indexed
+    template <typename T>
+    void visitField(const Field<Lazy<T> >& , const Lazy<T>& )
+    { }
+
+    void visitField(const Field<Blob>& , const Blob& )
+    { }
+
+    void visitField(const Field<Version>& field, const Version& value)
+    {
+        visitField(Field<int64_t>(field.label), value.value());
+    }
+
+    bool found() const
+    { return _found; }
+
+    const IndexKey& key() const
+    { return _key; }
+
+private:
+    const std::string& _label;
+    IndexKey _key;
+    bool _found;
+};
+
+/**
+ * Converts a lookup key by the affinity of the field it is compared with,
+ * TEXT for strings and numeric for the other indexable types.
+ */
+class IndexKeyConverter
+{
+    UTILCPP_DISABLE_COPY(IndexKeyConverter)
+
+public:
+    IndexKeyConverter(const std::string& label, IndexKey& key) :
+        _label(label), _key(key)
+    { }
+
+    template <typename T>
+    void visitField(const Field<T>& field, const T& )
+    {
+        if (field.label == _label)
+            _key = _key.asNumber();
+    }
+
+    void visitField(const Field<std::string>& field, const std::string& )
+    {
+        if (field.label == _label)
+            _key = _key.asText();
+    }
+
+    void visitField(const Field<const char*>& field, const char* const& )
+    {
+        if (field.label == _label)
+            _key = _key.asText();
+    }
+
+    template <typename T>
+    void visitField(const Field<Lazy<T> >& , const Lazy<T>& )
+    { }
+
+    void visitField(const Field<Blob>& , const Blob& )
+    { }
+
+private:
+    const std::string& _label;
+    IndexKey& _key;
+};
+
+/**
+ * Write-through cache of all entities of a repository in a hash table by
+ * id, with secondary indexes over selected fields. Results are returned in
+ * id order.
+ */
+template <class Entity, class Mapping>
+class IndexedEntityCache
+{
+    UTILCPP_DISABLE_COPY(IndexedEntityCache)
+
+public:
+    typedef std::vector<Entity> Entities;
+    typedef typename IdTypeOf<Mapping>::type Id;
+
+    IndexedEntityCache() :
+        _entities(), _indexes()
+    { }
+
+    bool enabled() const
+    { return !_indexes.empty(); }
+
+    bool hasIndex(const std::string& label, MemoryIndexType type) const
+    {
+        const Index* index = find(label);
+        return index && (type == HASH_INDEX || index->type == SORTED_INDEX);
+    }
+
+    static bool HasField(const std::string& label)
+    {
+        Entity entity;
+        IndexKeyExtractor extractor(label);
+        Mapping::accept(extractor, entity);
+        return extractor.found();
+    }
+
+    void addIndex(const std::string& label, MemoryIndexType type)
+    {
+        Index* index = find(label);
+        if (index)
+        {
+            index->type = type;
+        }
+        else
+        {
+            _indexes.push_back(Index());
+            _indexes.back().label = label;
+            _indexes.back().type = type;
+        }
+    }
+
+    void dropIndexes()
+    {
+        _indexes.clear();
+        _entities.clear();
+    }
+
+    void load(const Entities& entities)
+    {
+        _entities.clear();
+        for (size_t i = 0; i < _indexes.size(); ++i)
+        {
+            _indexes[i].hashed.clear();
+            _indexes[i].sorted.clear();
+        }
+
+        for (size_t i = 0; i < entities.size(); ++i)
+            put(entities[i]);
+    }
+
+    void put(const Entity& entity)
+    {
+        typename EntityMap::iterator it = _entities.find(entity.id);
+        if (it != _entities.end())
+        {
+            unindex(it->second);
+            it->second = entity;
+        }
+        else
+        {
+            _entities.insert(std::make_pair(entity.id, entity));
+        }
+
+        for (size_t i = 0; i < _indexes.size(); ++i)
+            _indexes[i].insert(keyOf(entity, _indexes[i].label), entity.id);
+    }
+
+    void remove(Id id)
+    {
+        typename EntityMap::iterator it = _entities.find(id);
+        if (it == _entities.end())
+            return;
+
+        unindex(it->second);
+        _entities.erase(it);
+    }
+
+    void clear()
+    {
+        load(Entities());
+    }
+
+    size_t size() const
+    { return _entities.size(); }
+
+    // The cached entity with the id, 0 if there is none.
+    const Entity* get(Id id) const
+    {
+        typename EntityMap::const_iterator it = _entities.find(id);
+        return it != _entities.end() ? &it->second : 0;
+    }
+
+    // Appends all entities in id order.
+    void all(Entities& result) const
+    {
+        std::vector<Id> ids;
+        ids.reserve(_entities.size());
+        for (typename EntityMap::const_iterator it = _entities.begin();
+             it != _entities.end(); ++it)
+            ids.push_back(it->first);
+
+        result.reserve(result.size() + ids.size());
+        collect(ids, result, ids.size());
+    }
+
+    // Indexes the cached entities again, after indexes were added.
+    void reindex()
+    {
+        Entities entities;
+        all(entities);
+        load(entities);
+    }
+
+    /**
+     * Appends up to limit entities whose field equals key, in id order.
+     */
+    void findEqual(const std::string& label, const IndexKey& value,
+                   Entities& result, size_t limit) const
+    {
+        const Index* index = find(label);
+        UTILCPP_RELEASE_ASSERT(index, "No memory index for field");
+
+        const IndexKey key = converted(label, value);
+
+        std::vector<Id> ids;
+        if (index->type == HASH_INDEX)
+        {
+            std::pair<typename HashIndex::const_iterator,
+                      typename HashIndex::const_iterator>
+                range = index->hashed.equal_range(key);
+            for (; range.first != range.second; ++range.first)
+                ids.push_back(range.first->second);
+        }
+        else
+        {
+            std::pair<typename SortedIndex::const_iterator,
+                      typename SortedIndex::const_iterator>
+                range = index->sorted.equal_range(key);
+            for (; range.first != range.second; ++range.first)
+                ids.push_back(range.first->second);
+        }
+
+        collect(ids, result, limit);
+    }
+
+    /**
+     * Appends entities whose field is in [from, to], in id order.
+     */
+    void findRange(const std::string& label,
+                   const IndexKey& fromValue, const IndexKey& toValue,
+                   Entities& result) const
+    {
+        const Index* index = find(label);
+        UTILCPP_RELEASE_ASSERT(index && index->type == SORTED_INDEX,
+                "No sorted memory index for field");
+
+        const IndexKey from = converted(label, fromValue);
+        const IndexKey to = converted(label, toValue);
+
+        if (to < from)
+            return;
+
+        std::vector<Id> ids;
+        typename SortedIndex::const_iterator it =
+            index->sorted.lower_bound(from);
+        typename SortedIndex::const_iterator end =
+            index->sorted.upper_bound(to);
+        for (; it != end; ++it)
+            ids.push_back(it->second);
+
+        collect(ids, result, ids.size());
+    }
+
+    /**
+     * Like findEqual() and findRange(), but for fields without an index,
+     * by comparing the field of every entity.
+     */
+    void scanEqual(const std::string& label, const IndexKey& value,
+                   Entities& result, size_t limit) const
+    {
+        const IndexKey key = converted(label, value);
+
+        std::vector<Id> ids;
+        for (typename EntityMap::const_iterator it = _entities.begin();
+             it != _entities.end(); ++it)
+            if (keyOf(it->second, label) == key)
+                ids.push_back(it->first);
+
+        collect(ids, result, limit);
+    }
+
+    void scanRange(const std::string& label,
+                   const IndexKey& fromValue, const IndexKey& toValue,
+                   Entities& result) const
+    {
+        const IndexKey from = converted(label, fromValue);
+        const IndexKey to = converted(label, toValue);
+
+        std::vector<Id> ids;
+        for (typename EntityMap::const_iterator it = _entities.begin();
+             it != _entities.end(); ++it)
+        {
+            const IndexKey key = keyOf(it->second, label);
+            if (!(key < from) && !(to < key))
+                ids.push_back(it->first);
+        }
+
+        collect(ids, result, ids.size());
+    }
+
+private:
+    typedef stdutil::unordered_map<Id, Entity> EntityMap;
+    typedef stdutil::unordered_multimap<IndexKey, Id, IndexKeyHash>
+        HashIndex;
+    typedef std::multimap<IndexKey, Id> SortedIndex;
+
+    struct Index
+    {
+        std::string label;
+        MemoryIndexType type;
+        HashIndex hashed;
+        SortedIndex sorted;
+
+        Index() :
+            label(), type(HASH_INDEX), hashed(), sorted()
+        { }
+
+        void insert(const IndexKey& key, Id id)
+        {
+            if (type == HASH_INDEX)
+                hashed.insert(std::make_pair(key, id));
+            else
+                sorted.insert(std::make_pair(key, id));
+        }
+
+        void erase(const IndexKey& key, Id id)
+        {
+            if (type == HASH_INDEX)
+                eraseFrom(hashed, key, id);
+            else
+                eraseFrom(sorted, key, id);
+        }
+
+        template <class Container>
+        static void eraseFrom(Container& container,
+                              const IndexKey& key, Id id)
+        {
+            std::pair<typename Container::iterator,
+                      typename Container::iterator>
+                range = container.equal_range(key);
+            for (; range.first != range.second; ++range.first)
+            {
+                if (range.first->second == id)
+                {
+                    container.erase(range.first);
+                    return;
+                }
+            }
+        }
+    };
+
+    static IndexKey keyOf(const Entity& entity, const std::string& label)
+    {
+        // accept() takes a non-const entity, the extractor does not modify it
+        IndexKeyExtractor extractor(label);
+        Mapping::accept(extractor, const_cast<Entity&>(entity));
+        return extractor.key();
+    }
+
+    static IndexKey converted(const std::string& label, IndexKey key)
+    {
+        Entity entity;
+        IndexKeyConverter converter(label, key);
+        Mapping::accept(converter, entity);
+        return key;
+    }
+
+    const Index* find(const std::string& label) const
+    {
+        for (size_t i = 0; i < _indexes.size(); ++i)
+            if (_indexes[i].label == label)
+                return &_indexes[i];
+        return 0;
+    }
+
+    Index* find(const std::string& label)
+    {
+        for (size_t i = 0; i < _indexes.size(); ++i)
+            if (_indexes[i].label == label)
+                return &_indexes[i];
+        return 0;
+    }
+
+    void unindex(const Entity& entity)
+    {
+        for (size_t i = 0; i < _indexes.size(); ++i)
+            _indexes[i].erase(keyOf(entity, _indexes[i].label), entity.id);
+    }
+
+    void collect(std::vector<Id>& ids, Entities& result, size_t limit) const
+    {
+        std::sort(ids.begin(), ids.end());
+        if (ids.size() > limit)
+            ids.resize(limit);
+
+        for (size_t i = 0; i < ids.size(); ++i)
+            result.push_back(_entities.find(ids[i])->second);
+    }
+
+    EntityMap _entities;
+    std::vector<Index> _indexes;
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_MEMORYINDEX_H__ */
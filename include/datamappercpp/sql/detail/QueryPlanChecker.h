@@ -0,0 +1,186 @@
+#ifndef DATAMAPPERCPP_QUERYPLANCHECKER_H__
+#define DATAMAPPERCPP_QUERYPLANCHECKER_H__
+
+#include <datamappercpp/sql/exceptions.h>
+
+#include <dbccpp/dbccpp.h>
+
+#include <cctype>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+
+namespace dm {
+namespace sql {
+
+enum QueryPlanCheck
+{
+    QUERY_PLAN_CHECK_OFF,
+    // write full scans to stderr
+    QUERY_PLAN_REPORT_SCANS,
+    // throw FullTableScanError on full scans
+    QUERY_PLAN_FAIL_ON_SCANS
+};
+
+/**
+ * Runs EXPLAIN QUERY PLAN on newly prepared statements and reports full
+ * scans of tables with at least a given number of rows.
+ *
+ * Only statements with a WHERE clause are checked, a full scan is what
+ * SELECT * FROM table asks for. Each distinct statement is checked once.
+ *
+ * The check is a runtime mode that SetQueryPlanCheck() switches in any
+ * build. Defining DATAMAPPERCPP_QUERY_PLAN_CHECK, e.g. in debug builds,
+ * only makes reporting the initial mode.
+ */
+class QueryPlanChecker
+{
+public:
+    static void configure(QueryPlanCheck mode, size_t minTableRows)
+    {
+        Settings& s = settings();
+        s.mode = mode;
+        s.minTableRows = minTableRows;
+        s.checked.clear();
+    }
+
+    static void check(const std::string& sql)
+    {
+        Settings& s = settings();
+        if (s.mode == QUERY_PLAN_CHECK_OFF || !hasWhereClause(sql)
+                || !s.checked.insert(sql).second)
+            return;
+
+        dbc::DbConnection& db = dbc::DbConnection::instance();
+        dbc::PreparedStatement::ptr plan(
+                db.prepareStatement("EXPLAIN QUERY PLAN " + sql));
+        dbc::ResultSet::ptr result(plan->executeQuery());
+
+        while (result->next())
+        {
+            // the last column is the human-readable detail
+            const std::string detail = result->get<std::string>(3);
+            const std::string table = scannedTable(detail);
+            if (table.empty())
+                continue;
+
+            const size_t rows = rowCount(table);
+            if (rows < s.minTableRows)
+                continue;
+
+            std::ostringstream msg;
+            msg << "Full scan of table " << table << " (" << rows
+                << " rows) in '" << sql << "'";
+
+            if (s.mode == QUERY_PLAN_FAIL_ON_SCANS)
+                throw FullTableScanError(msg.str());
+
+            std::cerr << "datamapper-cpp: " << msg.str() << std::endl;
+        }
+    }
+
+private:
+    struct Settings
+    {
+        QueryPlanCheck mode;
+        size_t minTableRows;
+        std::set<std::string> checked;
+
+        Settings() :
+#ifdef DATAMAPPERCPP_QUERY_PLAN_CHECK
+            mode(QUERY_PLAN_REPORT_SCANS),
+#else
+            mode(QUERY_PLAN_CHECK_OFF),
+#endif
+            minTableRows(1000),
+            checked()
+        { }
+    };
+
+    QueryPlanChecker();
+
+    static Settings& settings()
+    {
+        static Settings s;
+        return s;
+    }
+
+    static std::string upper(std::string s)
+    {
+        for (size_t i = 0; i < s.size(); ++i)
+            s[i] = static_cast<char>(std::toupper(
+                        static_cast<unsigned char>(s[i])));
+        return s;
+    }
+
+    static bool hasWhereClause(const std::string& sql)
+    {
+        const std::string statement = upper(sql);
+        const size_t start = statement.find_first_not_of(" \t\r\n");
+
+        if (start == std::string::npos
+                || (statement.compare(start, 6, "SELECT") != 0
+                    && statement.compare(start, 6, "UPDATE") != 0
+                    && statement.compare(start, 6, "DELETE") != 0))
+            return false;
+
+        // WHERE as a word, it may follow a newline or a parenthesis
+        for (size_t pos = statement.find("WHERE");
+             pos != std::string::npos;
+             pos = statement.find("WHERE", pos + 1))
+        {
+            const size_t end = pos + 5;
+            if ((pos == 0 || !isWordCharacter(statement[pos - 1]))
+                    && (end == statement.size()
+                        || !isWordCharacter(statement[end])))
+                return true;
+        }
+
+        return false;
+    }
+
+    static bool isWordCharacter(char c)
+    {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    // "SCAN person", older SQLite versions say "SCAN TABLE person"
+    static std::string scannedTable(const std::string& detail)
+    {
+        std::istringstream words(detail);
+        std::string word;
+
+        if (!(words >> word) || word != "SCAN" || !(words >> word))
+            return std::string();
+        if (word == "TABLE" && !(words >> word))
+            return std::string();
+        // subqueries and constant rows are not tables
+        if (word == "SUBQUERY" || word == "CONSTANT")
+            return std::string();
+
+        return word;
+    }
+
+    static size_t rowCount(const std::string& table)
+    {
+        try
+        {
+            dbc::DbConnection& db = dbc::DbConnection::instance();
+            dbc::PreparedStatement::ptr count(
+                    db.prepareStatement("SELECT count(*) FROM " + table));
+            dbc::ResultSet::ptr result(count->executeQuery());
+            result->next();
+            return static_cast<size_t>(result->get<double>(0));
+        }
+        catch (const dbc::DbErrorBase& )
+        {
+            // views and aliases
+            return 0;
+        }
+    }
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_QUERYPLANCHECKER_H__ */
@@ -0,0 +1,31 @@
+#ifndef DATAMAPPERCPP_SLEEP_H__
+#define DATAMAPPERCPP_SLEEP_H__
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <time.h>
+#endif
+
+namespace dm {
+namespace sql {
+
+inline void SleepMilliseconds(int milliseconds)
+{
+    if (milliseconds <= 0)
+        return;
+
+#ifdef _WIN32
+    Sleep(static_cast<DWORD>(milliseconds));
+#else
+    timespec duration;
+    duration.tv_sec = milliseconds / 1000;
+    duration.tv_nsec = (milliseconds % 1000) * 1000000L;
+    while (nanosleep(&duration, &duration) != 0)
+        ; // interrupted by a signal, sleep the rest
+#endif
+}
+
+} }
+
+#endif /* DATAMAPPERCPP_SLEEP_H__ */
@@ -2,6 +2,7 @@
 #define DATAMAPPERCPP_SQLBUILDER_H__
 
 #include <datamappercpp/Field.h>
+#include <datamappercpp/sql/detail/MappingTraits.h>
 #include <datamappercpp/sql/detail/StatementBuilderFieldVisitors.h>
 
 #include <utilcpp/release_assert.h>
@@ -25,16 +26,11 @@ public:
 
         // assume IF NOT EXISTS is useful
         sql << "CREATE TABLE IF NOT EXISTS " << Mapping::getLabel()
-            // assume all entities have surrogate keys named 'id'
-            << "(id INTEGER PRIMARY KEY AUTOINCREMENT,";
+            << TableDefinition();
 
-        FieldDeclarationBuilder fieldBuilder(sql);
-        Mapping::accept(fieldBuilder, _dummy_entity);
-
-        // replace last comma with ')'
-        long pos = sql.tellp();
-        sql.seekp(pos - 1);
-        sql << ")";
+        std::string indexStatements(CreateIndexStatements());
+        if (!indexStatements.empty())
+            sql << ";" << indexStatements;
 
         std::string customStatements(Mapping::customCreateStatements());
         if (!customStatements.empty())
@@ -43,8 +39,67 @@ public:
         return sql.str();
     }
 
+    // Indexes declared in Mapping::declareIndexes(), separated by ';'.
+    static std::string CreateIndexStatements()
+    {
+        const Indexes indexes = IndexesOf<Mapping>::get();
+        std::ostringstream sql;
+
+        for (size_t i = 0; i < indexes.size(); ++i)
+        {
+            if (i > 0)
+                sql << ";";
+
+            sql << CreateIndexStatement(indexes[i], Mapping::getLabel(),
+                    indexes[i].name(Mapping::getLabel()), true);
+        }
+
+        return sql.str();
+    }
+
+    // Declared index on table under the given name.
+    static std::string CreateIndexStatement(const Index& index,
+                                            const std::string& table,
+                                            const std::string& name,
+                                            bool ifNotExists)
+    {
+        std::ostringstream sql;
+
+        sql << "CREATE " << (index.isUnique() ? "UNIQUE " : "") << "INDEX "
+            << (ifNotExists ? "IF NOT EXISTS " : "") << name
+            << " ON " << table << " (";
+        for (size_t j = 0; j < index.fields().size(); ++j)
+            sql << (j > 0 ? "," : "") << index.fields()[j];
+        sql << ")";
+
+        if (!index.condition().empty())
+            sql << " WHERE " << index.condition();
+
+        return sql.str();
+    }
+
+    // Mapped table under another name, without custom statements.
+    static std::string CreateTableStatement(const std::string& table)
+    {
+        std::ostringstream sql;
+
+        sql << "CREATE TABLE " << table << TableDefinition();
+
+        return sql.str();
+    }
+
     static std::string InsertStatement()
     {
+        return BatchInsertStatement(1);
+    }
+
+    // Multi-row INSERT with placeholders for the given number of rows,
+    // withIds adds a leading placeholder for the id of each row.
+    static std::string BatchInsertStatement(size_t rows,
+                                            bool withIds = false)
+    {
+        UTILCPP_RELEASE_ASSERT(rows > 0, "Batch must have at least one row");
+
         std::ostringstream sql;
 
         sql << "INSERT INTO " << Mapping::getLabel() << " ";
@@ -52,6 +107,12 @@ public:
         std::ostringstream columnLabels;
         std::ostringstream fieldPlaceholders;
 
+        if (withIds)
+        {
+            columnLabels << "id,";
+            fieldPlaceholders << "?,";
+        }
+
         InsertStatementFieldBuilder fieldBuilder(columnLabels,
                                                  fieldPlaceholders);
         Mapping::accept(fieldBuilder, _dummy_entity);
@@ -65,10 +126,21 @@ public:
         s.erase(s.end() - 1);
 
         sql << " VALUES (" << s << ")";
+        for (size_t i = 1; i < rows; ++i)
+            sql << ",(" << s << ")";
 
         return sql.str();
     }
 
+    // Number of fields in the mapping, excluding id.
+    static size_t FieldCount()
+    {
+        FieldCounter counter;
+        Mapping::accept(counter, _dummy_entity);
+
+        return counter.count();
+    }
+
     static std::string UpdateStatement()
     {
         std::ostringstream sql;
@@ -83,6 +155,12 @@ public:
 
         sql << " WHERE id=?";
 
+        // optimistic concurrency control
+        VersionFieldFinder versionFinder;
+        Mapping::accept(versionFinder, _dummy_entity);
+        if (versionFinder.found())
+            sql << " AND " << versionFinder.label() << "=?";
+
         return sql.str();
     }
 
@@ -109,7 +187,19 @@ public:
     {
         std::ostringstream sql;
 
-        sql << "SELECT * FROM " << Mapping::getLabel();
+        sql << "SELECT " << SelectColumns(false)
+            << " FROM " << Mapping::getLabel();
+
+        return sql.str();
+    }
+
+    // Like SelectAllStatement(), but includes lazy columns.
+    static std::string SelectAllColumnsStatement()
+    {
+        std::ostringstream sql;
+
+        sql << "SELECT " << SelectColumns(true)
+            << " FROM " << Mapping::getLabel();
 
         return sql.str();
     }
@@ -123,13 +213,168 @@ public:
     {
         std::ostringstream sql;
 
-        sql << "SELECT * FROM " << Mapping::getLabel()
+        sql << "SELECT " << SelectColumns(false)
+            << " FROM " << Mapping::getLabel()
             << " WHERE " << field << "=?";
 
         return sql.str();
     }
 
+    static std::string SelectByFieldRangeStatement(const std::string field)
+    {
+        std::ostringstream sql;
+
+        sql << "SELECT " << SelectColumns(false)
+            << " FROM " << Mapping::getLabel()
+            << " WHERE " << field << " BETWEEN ? AND ?";
+
+        return sql.str();
+    }
+
+    // Single-value query of an aggregate expression like "count(*)", over
+    // the rows whose filterField equals a bound value if one is given.
+    static std::string AggregateStatement(const std::string& aggregate,
+                                          const std::string& filterField)
+    {
+        std::ostringstream sql;
+
+        sql << "SELECT " << aggregate << " FROM " << Mapping::getLabel();
+        if (!filterField.empty())
+            sql << " WHERE " << filterField << "=?";
+
+        return sql.str();
+    }
+
+    static std::string ExistsStatement(const std::string& filterField)
+    {
+        std::ostringstream sql;
+
+        sql << "SELECT EXISTS (SELECT 1 FROM " << Mapping::getLabel();
+        if (!filterField.empty())
+            sql << " WHERE " << filterField << "=?";
+        sql << ")";
+
+        return sql.str();
+    }
+
+    // Next rows after an id in id order, for paging through a table
+    // without OFFSET.
+    static std::string SelectBatchAfterIdStatement()
+    {
+        std::ostringstream sql;
+
+        sql << "SELECT " << SelectColumns(false)
+            << " FROM " << Mapping::getLabel()
+            << " WHERE id>? ORDER BY id LIMIT ?";
+
+        return sql.str();
+    }
+
+    static std::string SelectByFieldValuesStatement(const std::string field,
+                                                    size_t count)
+    {
+        std::ostringstream sql;
+
+        sql << "SELECT " << SelectColumns(false)
+            << " FROM " << Mapping::getLabel()
+            << " WHERE " << field << " IN (" << Placeholders(count) << ")";
+
+        return sql.str();
+    }
+
+    static std::string AllocateBlobStatement(const std::string field)
+    {
+        std::ostringstream sql;
+
+        sql << "UPDATE " << Mapping::getLabel() << " SET " << field
+            << "=zeroblob(?) WHERE id=?";
+
+        return sql.str();
+    }
+
+    static std::string SelectFieldByIdsStatement(const std::string field,
+                                                 size_t count)
+    {
+        std::ostringstream sql;
+
+        sql << "SELECT id," << field << " FROM " << Mapping::getLabel()
+            << " WHERE id IN (" << Placeholders(count) << ")";
+
+        return sql.str();
+    }
+
+    // Comma-separated list of count placeholders.
+    static std::string Placeholders(size_t count)
+    {
+        UTILCPP_RELEASE_ASSERT(count > 0, "At least one placeholder needed");
+
+        std::string placeholders("?");
+        for (size_t i = 1; i < count; ++i)
+            placeholders += ",?";
+
+        return placeholders;
+    }
+
+    /**
+     * Column list of SELECT statements: id followed by the mapped fields.
+     * Lazy fields are left out unless includeLazy is set, so ObjectFieldBinder
+     * can read the columns by position.
+     */
+    static std::string SelectColumns(bool includeLazy)
+    {
+        std::ostringstream columns;
+
+        columns << "id";
+
+        SelectColumnsBuilder columnsBuilder(columns, includeLazy);
+        Mapping::accept(columnsBuilder, _dummy_entity);
+
+        return columns.str();
+    }
+
+    /**
+     * Whether the blob columns of sql hold the hex text of small blobs,
+     * i.e. the mapping has blob fields and sql selects SelectColumns().
+     */
+    static bool SelectsInlineBlobs(const std::string& sql)
+    {
+        static const std::string select =
+            "SELECT " + SelectColumns(false) + " ";
+        return HasBlobFields() && sql.compare(0, select.size(), select) == 0;
+    }
+
+    static bool HasBlobFields()
+    {
+        static const bool found = FindBlobFields();
+        return found;
+    }
+
 private:
+    static std::string TableDefinition()
+    {
+        std::ostringstream sql;
+
+        // assume all entities have surrogate keys named 'id'
+        sql << "(id INTEGER PRIMARY KEY AUTOINCREMENT,";
+
+        FieldDeclarationBuilder fieldBuilder(sql);
+        Mapping::accept(fieldBuilder, _dummy_entity);
+
+        // replace last comma with ')'
+        long pos = sql.tellp();
+        sql.seekp(pos - 1);
+        sql << ")";
+
+        return sql.str();
+    }
+
+    static bool FindBlobFields()
+    {
+        BlobFieldFinder finder;
+        Mapping::accept(finder, _dummy_entity);
+        return finder.found();
+    }
+
     // disable instantiation to assure the class is only used via it's static
     // functions
     SqlStatementBuilder();
@@ -0,0 +1,175 @@
+#ifndef DATAMAPPERCPP_SQLITEHANDLE_H__
+#define DATAMAPPERCPP_SQLITEHANDLE_H__
+
+#include "../../../../lib/dbccpp/src/sqlite/SQLiteConnection.h"
+#include <sqlite3.h>
+
+#include <datamappercpp/sql/detail/Backend.h>
+
+#include <datamappercpp/Version.h>
+
+#include <dbccpp/dbccpp.h>
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace dm {
+namespace sql {
+
+/**
+ * Access to the native SQLite handle behind the dbc-cpp connection, for
+ * the SQLite APIs that dbc-cpp does not wrap. Only SqliteBackend.h and the
+ * SQLite-specific headers include this.
+ */
+class SqliteHandle
+{
+public:
+    // Cached per connection, see Backend::connectionChanged(), to avoid a
+    // dynamic_cast on every call.
+    static sqlite3* get()
+    {
+        Cache& c = cache();
+        dbc::DbConnection& db = dbc::DbConnection::instance();
+        if (!c.handle || c.connection != &db
+                || c.generation != Backend::connectionGeneration())
+        {
+            c.handle = dynamic_cast<dbc::SQLiteConnection&>(db).handle();
+            c.connection = &db;
+            c.generation = Backend::connectionGeneration();
+        }
+        return c.handle;
+    }
+
+    // dbc-cpp PreparedStatement::getLastInsertId() is limited to int
+    static int64_t lastInsertId()
+    {
+        return sqlite3_last_insert_rowid(get());
+    }
+
+    // whether the last failure was due to another connection's lock
+    static bool isBusy()
+    {
+        const int code = sqlite3_errcode(get());
+        return code == SQLITE_BUSY || code == SQLITE_LOCKED;
+    }
+
+    /**
+     * Outcome of the open transaction of the connection. It is resolved by
+     * SQLite commit and rollback hooks, so rollbacks of transactions that
+     * Transaction does not manage and those that SQLite does on its own
+     * after errors are seen as well.
+     */
+    static const TransactionOutcomePtr& transactionOutcome()
+    {
+        installHooks();
+
+        Hooks& h = hooks();
+        if (!h.outcome)
+            h.outcome.reset(new TransactionOutcome());
+        return h.outcome;
+    }
+
+    typedef Backend::RollbackListener RollbackListener;
+
+    // Calls listener on every rollback of the connection, see
+    // transactionOutcome().
+    static void addRollbackListener(RollbackListener listener)
+    {
+        installHooks();
+
+        std::vector<RollbackListener>& listeners = hooks().listeners;
+        if (std::find(listeners.begin(), listeners.end(), listener)
+                == listeners.end())
+            listeners.push_back(listener);
+    }
+
+    // Called by Transaction when COMMIT failed but left the transaction
+    // open, e.g. with SQLITE_BUSY, after the commit hook has already run.
+    static void commitFailed()
+    {
+        Hooks& h = hooks();
+        if (!h.outcome)
+            h.outcome = h.committing;
+    }
+
+private:
+    struct Cache
+    {
+        dbc::DbConnection* connection;
+        sqlite3* handle;
+        unsigned generation;
+
+        Cache() :
+            connection(0), handle(0), generation(0)
+        { }
+    };
+
+    struct Hooks
+    {
+        TransactionOutcomePtr outcome;
+        TransactionOutcomePtr committing;
+        std::vector<RollbackListener> listeners;
+        sqlite3* installedOn;
+        unsigned installedGeneration;
+
+        Hooks() :
+            outcome(), committing(), listeners(), installedOn(0),
+            installedGeneration(0)
+        { }
+    };
+
+    SqliteHandle();
+
+    static Cache& cache()
+    {
+        static Cache c;
+        return c;
+    }
+
+    static Hooks& hooks()
+    {
+        static Hooks h;
+        return h;
+    }
+
+    // installed again when the connection has been replaced
+    static void installHooks()
+    {
+        sqlite3* db = get();
+        Hooks& h = hooks();
+        if (h.installedOn == db
+                && h.installedGeneration == Backend::connectionGeneration())
+            return;
+
+        sqlite3_commit_hook(db, &commitHook, 0);
+        sqlite3_rollback_hook(db, &rollbackHook, 0);
+        h.installedOn = db;
+        h.installedGeneration = Backend::connectionGeneration();
+    }
+
+    static int commitHook(void* )
+    {
+        Hooks& h = hooks();
+        h.committing = h.outcome;
+        h.outcome.reset();
+        return 0;
+    }
+
+    static void rollbackHook(void* )
+    {
+        Hooks& h = hooks();
+        if (h.outcome)
+            h.outcome->rolledBack = true;
+        h.outcome.reset();
+        h.committing.reset();
+
+        for (size_t i = 0; i < h.listeners.size(); ++i)
+            h.listeners[i]();
+    }
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_SQLITEHANDLE_H__ */
@@ -1,4 +1,10 @@
+#ifndef DATAMAPPERCPP_STATEMENTBUILDERFIELDVISITORS_H__
+#define DATAMAPPERCPP_STATEMENTBUILDERFIELDVISITORS_H__
+
+#include <datamappercpp/Blob.h>
 #include <datamappercpp/Field.h>
+#include <datamappercpp/Lazy.h>
+#include <datamappercpp/Version.h>
 
 #include <utilcpp/disable_copy.h>
 
@@ -44,6 +50,25 @@ public:
         _placeholders << "?,";
     }
 
+    // blob contents are written with incremental I/O after the insert
+    void visitField(const Field<Blob>& field, const Blob& )
+    {
+        _labels << field.label << ",";
+        _placeholders << "zeroblob(?),";
+    }
+
+    void visitField(const Field<Lazy<Blob> >& field, const Lazy<Blob>& )
+    {
+        visitField(Field<Blob>(field.label), Blob());
+    }
+
+    // versions start at 1
+    void visitField(const Field<Version>& field, const Version& )
+    {
+        _labels << field.label << ",";
+        _placeholders << "1,";
+    }
+
 private:
     std::ostringstream& _labels;
     std::ostringstream& _placeholders;
@@ -64,8 +89,153 @@ public:
         _out << field.label << "=?,";
     }
 
+    void visitField(const Field<Blob>& field, const Blob& )
+    {
+        _out << field.label << "=zeroblob(?),";
+    }
+
+    void visitField(const Field<Lazy<Blob> >& field, const Lazy<Blob>& )
+    {
+        visitField(Field<Blob>(field.label), Blob());
+    }
+
+    void visitField(const Field<Version>& field, const Version& )
+    {
+        _out << field.label << "=" << field.label << "+1,";
+    }
+
 private:
     std::ostringstream& _out;
 };
 
+class SelectColumnsBuilder
+{
+    UTILCPP_DISABLE_COPY(SelectColumnsBuilder)
+
+public:
+    SelectColumnsBuilder(std::ostringstream& out, bool includeLazy) :
+        _out(out),
+        _includeLazy(includeLazy)
+    { }
+
+    template <typename T>
+    void visitField(const Field<T>& field, const T& )
+    {
+        _out << "," << field.label;
+    }
+
+    template <typename T>
+    void visitField(const Field<Lazy<T> >& field, const Lazy<T>& )
+    {
+        if (_includeLazy)
+            _out << "," << field.label;
+    }
+
+    enum
+    {
+        // beyond this the blob_open() of incremental I/O costs less than
+        // copying the hex text
+        MAX_INLINE_BLOB_SIZE = 8192
+    };
+
+    // Small blobs are selected as hex text, larger ones are NULL and read
+    // with incremental I/O, see ObjectFieldBinder.
+    void visitField(const Field<Blob>& field, const Blob& )
+    {
+        _out << ",CASE WHEN " << field.label << " IS NULL THEN ''"
+             << " WHEN length(" << field.label << ")<="
+             << MAX_INLINE_BLOB_SIZE << " THEN hex(" << field.label << ")"
+             << " END";
+    }
+
+private:
+    std::ostringstream& _out;
+    bool _includeLazy;
+};
+
+/**
+ * Finds the version field of an entity, if the mapping has one.
+ */
+class VersionFieldFinder
+{
+    UTILCPP_DISABLE_COPY(VersionFieldFinder)
+
+public:
+    VersionFieldFinder() :
+        _label(), _version(0)
+    { }
+
+    template <typename T>
+    void visitField(const Field<T>& , const T& )
+    { }
+
+    void visitField(const Field<Version>& field, Version& version)
+    {
+        _label = field.label;
+        _version = &version;
+    }
+
+    bool found() const
+    { return _version != 0; }
+
+    const std::string& label() const
+    { return _label; }
+
+    Version& version() const
+    { return *_version; }
+
+private:
+    std::string _label;
+    Version* _version;
+};
+
+class BlobFieldFinder
+{
+    UTILCPP_DISABLE_COPY(BlobFieldFinder)
+
+public:
+    BlobFieldFinder() :
+        _found(false)
+    { }
+
+    template <typename T>
+    void visitField(const Field<T>& , const T& )
+    { }
+
+    void visitField(const Field<Blob>& , const Blob& )
+    {
+        _found = true;
+    }
+
+    bool found() const
+    { return _found; }
+
+private:
+    bool _found;
+};
+
+class FieldCounter
+{
+    UTILCPP_DISABLE_COPY(FieldCounter)
+
+public:
+    FieldCounter() :
+        _count(0)
+    { }
+
+    template <typename T>
+    void visitField(const Field<T>& , const T& )
+    {
+        ++_count;
+    }
+
+    size_t count() const
+    { return _count; }
+
+private:
+    size_t _count;
+};
+
 } }
+
+#endif /* DATAMAPPERCPP_STATEMENTBUILDERFIELDVISITORS_H__ */
@@ -0,0 +1,50 @@
+#ifndef DATAMAPPERCPP_STOPWATCH_H__
+#define DATAMAPPERCPP_STOPWATCH_H__
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <time.h>
+#endif
+
+namespace dm {
+namespace sql {
+
+/**
+ * Measures elapsed wall-clock time with a monotonic clock.
+ */
+class Stopwatch
+{
+public:
+    Stopwatch() :
+        _start(now())
+    { }
+
+    void restart()
+    { _start = now(); }
+
+    double elapsedSeconds() const
+    { return now() - _start; }
+
+    static double now()
+    {
+#ifdef _WIN32
+        LARGE_INTEGER frequency, counter;
+        QueryPerformanceFrequency(&frequency);
+        QueryPerformanceCounter(&counter);
+        return static_cast<double>(counter.QuadPart)
+            / static_cast<double>(frequency.QuadPart);
+#else
+        timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return static_cast<double>(time.tv_sec) + time.tv_nsec / 1e9;
+#endif
+    }
+
+private:
+    double _start;
+};
+
+} }
+
+#endif /* DATAMAPPERCPP_STOPWATCH_H__ */
@@ -0,0 +1,157 @@
+#ifndef DATAMAPPERCPP_VALUECODEC_H__
+#define DATAMAPPERCPP_VALUECODEC_H__
+
+#include <datamappercpp/sql/db.h>
+
+#include <dbccpp/dbccpp.h>
+
+#include <stdint.h>
+
+#include <climits>
+#include <sstream>
+#include <string>
+
+namespace dm {
+namespace sql {
+
+/**
+ * Binds field values to statements and reads them from result sets.
+ *
+ * dbc-cpp itself only handles int, bool, double and std::string, wider
+ * integer types are passed through WideIntegerCodec.
+ */
+template <typename T>
+struct ValueCodec
+{
+    static void bind(Statement& statement, const T& value)
+    { *statement << value; }
+
+    static T read(const dbc::ResultSet& result, int column)
+    { return result.get<T>(column); }
+};
+
+/**
+ * 64-bit integers are bound as int when they fit and as decimal text
+ * otherwise, INTEGER column affinity makes SQLite store the text as an
+ * integer. They are read back as double, which is exact below 2^53, so
+ * only larger values take the slower text path.
+ */
+class WideIntegerCodec
+{
+public:
+    static void bind(Statement& statement, int64_t value)
+    {
+        if (value >= INT_MIN && value <= INT_MAX)
+        {
+            *statement << static_cast<int>(value);
+        }
+        else
+        {
+            std::ostringstream text;
+            text << value;
+            *statement << text.str();
+        }
+    }
+
+    static int64_t read(const dbc::ResultSet& result, int column)
+    {
+        // 2^53, the largest range of integers a double holds exactly
+        static const double exactLimit = 9007199254740992.0;
+
+        double value = result.get<double>(column);
+        if (value > -exactLimit && value < exactLimit)
+            return static_cast<int64_t>(value);
+
+        std::istringstream text(result.get<std::string>(column));
+        int64_t wide = 0;
+        text >> wide;
+        return wide;
+    }
+
+private:
+    WideIntegerCodec();
+};
+
+template <>
+struct ValueCodec<int64_t>
+{
+    static void bind(Statement& statement, int64_t value)
+    { WideIntegerCodec::bind(statement, value); }
+
+    static int64_t read(const dbc::ResultSet& result, int column)
+    { return WideIntegerCodec::read(result, column); }
+};
+
+template <>
+struct ValueCodec<uint32_t>
+{
+    static void bind(Statement& statement, uint32_t value)
+    { WideIntegerCodec::bind(statement, value); }
+
+    static uint32_t read(const dbc::ResultSet& result, int column)
+    { return static_cast<uint32_t>(WideIntegerCodec::read(result, column)); }
+};
+
+/**
+ * Stored as the signed 64-bit integer with the same bits, so every value
+ * round-trips, e.g. hashes and checksums. Values from 2^63 upwards are
+ * negative in SQL: they sort before smaller values, Min(), Max(), Sum()
+ * and GetManyByRange() treat them as negative, and sorted memory indexes
+ * order them the same way. Map quantities that need unsigned order above
+ * 2^63 to another type.
+ */
+template <>
+struct ValueCodec<uint64_t>
+{
+    static void bind(Statement& statement, uint64_t value)
+    { WideIntegerCodec::bind(statement, static_cast<int64_t>(value)); }
+
+    static uint64_t read(const dbc::ResultSet& result, int column)
+    { return static_cast<uint64_t>(WideIntegerCodec::read(result, column)); }
+};
+
+/**
+ * Result type of Repository::Sum() over a field. Narrower integers are
+ * summed as int64_t, as SQLite does, so that the sum does not overflow.
+ */
+template <typename T>
+struct SumTypeOf
+{
+    typedef T type;
+};
+
+template <>
+struct SumTypeOf<int>
+{
+    typedef int64_t type;
+};
+
+template <>
+struct SumTypeOf<uint32_t>
+{
+    typedef int64_t type;
+};
+
+template <>
+struct SumTypeOf<bool>
+{
+    typedef int64_t type;
+};
+
+/**
+ * Binds a query argument, the overload takes care of string literals.
+ */
+template <typename T>
+inline void BindValue(Statement& statement, const T& value)
+{
+    ValueCodec<T>::bind(statement, value);
+}
+
+inline void BindValue(Statement& statement, const char* value)
+{
+    *statement << value;
+}
+
+} }
+
+#endif /* DATAMAPPERCPP_VALUECODEC_H__ */
@@ -0,0 +1,26 @@
+#ifndef DATAMAPPERCPP_STDUTIL_H__
+#define DATAMAPPERCPP_STDUTIL_H__
+
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || (__cplusplus > 199711L)
+  #include <functional>
+  #include <memory>
+  #include <mutex>
+  #include <unordered_map>
+  namespace dm
+  {
+      namespace stdutil = std;
+  }
+#else
+  #include <boost/function.hpp>
+  #include <boost/functional/hash.hpp>
+  #include <boost/shared_ptr.hpp>
+  #include <boost/thread/lock_guard.hpp>
+  #include <boost/thread/recursive_mutex.hpp>
+  #include <boost/unordered_map.hpp>
+  namespace dm
+  {
+      namespace stdutil = boost;
+  }
+#endif
+
+#endif /* DATAMAPPERCPP_STDUTIL_H__ */
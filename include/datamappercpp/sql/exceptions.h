@@ -26,6 +26,16 @@ public:
     { }
 };
 
+// Update of a versioned entity found the row changed or deleted by someone
+// else since it was loaded.
+class ConcurrentModificationError : public NotOneError
+{
+public:
+    ConcurrentModificationError(const std::string& msg) :
+        NotOneError(msg)
+    { }
+};
+
 class DoesNotExistError : public ErrorBase
 {
 public:
@@ -34,6 +44,81 @@ public:
     { }
 };
 
+class SnapshotError : public ErrorBase
+{
+public:
+    SnapshotError(const std::string& msg) :
+        ErrorBase(msg)
+    { }
+};
+
+class BlobError : public ErrorBase
+{
+public:
+    BlobError(const std::string& msg) :
+        ErrorBase(msg)
+    { }
+};
+
+class FullTableScanError : public ErrorBase
+{
+public:
+    FullTableScanError(const std::string& msg) :
+        ErrorBase(msg)
+    { }
+};
+
+class ReplicaError : public ErrorBase
+{
+public:
+    ReplicaError(const std::string& msg) :
+        ErrorBase(msg)
+    { }
+};
+
+class BulkLoadError : public ErrorBase
+{
+public:
+    BulkLoadError(const std::string& msg) :
+        ErrorBase(msg)
+    { }
+};
+
+class CodecError : public ErrorBase
+{
+public:
+    CodecError(const std::string& msg) :
+        ErrorBase(msg)
+    { }
+};
+
+class MigrationError : public ErrorBase
+{
+public:
+    MigrationError(const std::string& msg) :
+        ErrorBase(msg)
+    { }
+};
+
+// A Transaction was opened while another one was open, e.g. a repository
+// call without enableTransaction = false inside RunInTransaction().
+class NestedTransactionError : public ErrorBase
+{
+public:
+    NestedTransactionError(const std::string& msg) :
+        ErrorBase(msg)
+    { }
+};
+
+// No Backend was installed, see detail/Backend.h.
+class BackendError : public ErrorBase
+{
+public:
+    BackendError(const std::string& msg) :
+        ErrorBase(msg)
+    { }
+};
+
 } }
 
 #endif /* EXCEPTIONS_H */
@@ -1,7 +1,7 @@
 #ifndef INSTALL_TRACE_H__
 #define INSTALL_TRACE_H__
 
-#include "../../../../lib/dbccpp/src/sqlite/SQLiteConnection.h"
+#include <datamappercpp/sql/SqliteBackend.h>
 #include <sqlite3.h>
 #include <iostream>
 
@@ -15,9 +15,7 @@ static void trace(void*, const char* sql)
 
 static void TraceSqlToStderr()
 {
-    dbc::DbConnection& db = dbc::DbConnection::instance();
-    dbc::SQLiteConnection& sqlitedb = dynamic_cast<dbc::SQLiteConnection&>(db);
-    sqlite3_trace(sqlitedb.handle(), trace, 0);
+    sqlite3_trace(SqliteHandle::get(), trace, 0);
 }
 
 }
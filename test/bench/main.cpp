@@ -0,0 +1,466 @@
+#include <datamappercpp/sql/BinaryCodec.h>
+#include <datamappercpp/sql/BulkLoad.h>
+#include <datamappercpp/sql/Repository.h>
+#include <datamappercpp/sql/SqliteBackend.h>
+#include <datamappercpp/sql/db.h>
+
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || (__cplusplus > 199711L)
+  #include <datamappercpp/sql/AsyncRepository.h>
+
+  #include <condition_variable>
+  #include <deque>
+  #include <exception>
+  #include <mutex>
+  #define DATAMAPPERCPP_BENCH_ASYNC 1
+#endif
+
+#include <datamappercpp/sql/detail/Stopwatch.h>
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/* Timings of the performance-sensitive paths of the library.
+ *
+ * Usage: datamappercpp-bench [rows [benchmark]]
+ *
+ * rows defaults to 1000000. benchmark runs only one of batch, latency,
+ * bulkload or codec.
+ *
+ * Every benchmark runs against a fresh table in bench.sqlite and prints
+ * the best of a few runs, so that the numbers can be compared before and
+ * after a change on the same machine.
+ */
+
+struct Row
+{
+    typedef std::vector<Row> list;
+
+    int64_t id;
+    std::string name;
+    int value;
+    double score;
+
+    Row() :
+        id(-1), name(), value(0), score(0.0)
+    { }
+};
+
+class RowMapping
+{
+public:
+    static std::string getLabel()
+    { return "bench_row"; }
+
+    template <class Visitor>
+    static void accept(Visitor& v, Row& r)
+    {
+        v.visitField(dm::Field<std::string>("name"), r.name);
+        v.visitField(dm::Field<int>("value"), r.value);
+        v.visitField(dm::Field<double>("score"), r.score);
+    }
+
+    static std::string customCreateStatements()
+    { return std::string(); }
+};
+
+class RowRepository : public dm::sql::Repository<Row, RowMapping>
+{ };
+
+#ifdef DATAMAPPERCPP_BENCH_ASYNC
+typedef dm::sql::AsyncRepository<Row, RowMapping> RowAsync;
+
+// Minimal event loop, completions posted by the worker run on the thread
+// that calls runOne().
+class EventLoop
+{
+public:
+    EventLoop() :
+        _jobs(), _mutex(), _posted()
+    { }
+
+    void post(dm::sql::DbWorker::Job job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.push_back(std::move(job));
+        }
+        _posted.notify_one();
+    }
+
+    // Waits for a job and returns the time spent running it, the time
+    // the loop thread was blocked.
+    double runOne()
+    {
+        dm::sql::DbWorker::Job job;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (_jobs.empty())
+                _posted.wait(lock);
+            job = std::move(_jobs.front());
+            _jobs.pop_front();
+        }
+
+        dm::sql::Stopwatch stopwatch;
+        job();
+        return stopwatch.elapsedSeconds();
+    }
+
+private:
+    std::deque<dm::sql::DbWorker::Job> _jobs;
+    std::mutex _mutex;
+    std::condition_variable _posted;
+};
+#endif
+
+namespace
+{
+
+const int RUNS = 10;
+// loads of the whole table are slow at the sizes they are meant for
+const int BULK_RUNS = 3;
+
+// Names longer than the small string buffer of common std::string
+// implementations, so that every loaded name is a heap allocation.
+std::string RowName(size_t i, size_t length)
+{
+    std::ostringstream name;
+    name << i << '-';
+    return name.str() + std::string(length, 'x');
+}
+
+Row::list MakeRows(size_t count, size_t nameLength)
+{
+    Row::list rows(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        rows[i].name = RowName(i, nameLength);
+        rows[i].value = static_cast<int>(i);
+        rows[i].score = i * 0.5;
+    }
+    return rows;
+}
+
+void ResetTable(size_t count, size_t nameLength)
+{
+    dm::sql::ExecuteStatement("DROP TABLE IF EXISTS "
+                              + RowMapping::getLabel());
+    RowRepository::CreateTable();
+
+    Row::list rows = MakeRows(count, nameLength);
+    RowRepository::Save(rows);
+}
+
+void Report(const char* name, double seconds, size_t rows)
+{
+    std::printf("  %-44s %9.3f ms %9.1f ns/row\n", name, seconds * 1e3,
+                seconds * 1e9 / static_cast<double>(rows));
+}
+
+// Reads the table with the SQLite C API without building entities, the
+// lower bound of what GetAll() can cost.
+double ReadRaw(size_t& checksum)
+{
+    dm::sql::Stopwatch stopwatch;
+
+    sqlite3_stmt* statement = 0;
+    sqlite3_prepare_v2(dm::sql::SqliteHandle::get(),
+            "SELECT id,name,value,score FROM bench_row", -1, &statement, 0);
+    while (sqlite3_step(statement) == SQLITE_ROW)
+        checksum += static_cast<size_t>(sqlite3_column_bytes(statement, 1));
+    sqlite3_finalize(statement);
+
+    return stopwatch.elapsedSeconds();
+}
+
+// Loading batches into a new collection every time, timed until the
+// collection has been freed, and into one collection that is clear()-ed
+// and reused, see GetAll(Entities&).
+void BenchBatchReuse(size_t rows)
+{
+    const size_t nameLengths[] = { 4, 40 };
+
+    for (size_t n = 0; n < sizeof(nameLengths) / sizeof(nameLengths[0]); ++n)
+    {
+        ResetTable(rows, nameLengths[n]);
+
+        double raw = 1e9, fresh = 1e9, reused = 1e9, cleared = 1e9;
+        Row::list batch;
+        size_t checksum = 0;
+
+        for (int run = 0; run < RUNS; ++run)
+        {
+            raw = std::min(raw, ReadRaw(checksum));
+
+            dm::sql::Stopwatch stopwatch;
+            {
+                Row::list all = RowRepository::GetAll();
+                checksum += all.size();
+            }
+            fresh = std::min(fresh, stopwatch.elapsedSeconds());
+
+            stopwatch.restart();
+            batch.clear();
+            const double clearing = stopwatch.elapsedSeconds();
+
+            stopwatch.restart();
+            RowRepository::GetAll(batch);
+            const double loading = stopwatch.elapsedSeconds();
+            checksum += batch.size();
+
+            // the first run fills the empty collection
+            if (run > 0)
+            {
+                cleared = std::min(cleared, clearing);
+                reused = std::min(reused, clearing + loading);
+            }
+        }
+
+        std::printf("GetAll, %lu rows, %lu character names (checksum %lu)\n",
+                    static_cast<unsigned long>(rows),
+                    static_cast<unsigned long>(nameLengths[n]),
+                    static_cast<unsigned long>(checksum));
+        Report("sqlite3_step only, no entities", raw, rows);
+        Report("new collection, load and free", fresh, rows);
+        Report("reused collection, clear() and load", reused, rows);
+        Report("  of which clear()", cleared, rows);
+    }
+}
+
+void ResetIds(Row::list& rows)
+{
+    for (size_t i = 0; i < rows.size(); ++i)
+        rows[i].id = -1;
+}
+
+// Replacing the contents of a table with two secondary indexes by
+// DeleteAll() and Save() and in a BulkLoad session, including recreating
+// the indexes.
+void BenchBulkLoad(size_t rows)
+{
+    ResetTable(0, 40);
+    dm::sql::ExecuteStatement("CREATE INDEX bench_row_name_idx "
+                              "ON bench_row (name)");
+    dm::sql::ExecuteStatement("CREATE INDEX bench_row_value_idx "
+                              "ON bench_row (value)");
+
+    Row::list source = MakeRows(rows, 40);
+    RowRepository::Save(source);
+
+    double saved = 1e9, loaded = 1e9;
+
+    for (int run = 0; run < BULK_RUNS; ++run)
+    {
+        ResetIds(source);
+        dm::sql::Stopwatch stopwatch;
+        RowRepository::DeleteAll();
+        RowRepository::Save(source);
+        saved = std::min(saved, stopwatch.elapsedSeconds());
+
+        ResetIds(source);
+        stopwatch.restart();
+        {
+            dm::sql::BulkLoad<Row, RowMapping> load;
+            RowRepository::DeleteAll();
+            load.insert(source);
+            load.finish();
+        }
+        loaded = std::min(loaded, stopwatch.elapsedSeconds());
+    }
+
+    std::printf("Replace table with 2 indexes, %lu rows (count %lu)\n",
+                static_cast<unsigned long>(rows),
+                static_cast<unsigned long>(RowRepository::Count()));
+    Report("DeleteAll() and Save()", saved, rows);
+    Report("BulkLoad insert() and finish()", loaded, rows);
+}
+
+// The same fields written with iostreams, the usual hand-rolled cache
+// format that BinaryCodec replaces.
+void StreamEncode(const Row::list& rows, std::string& out)
+{
+    std::ostringstream stream;
+    // round-trips doubles like BinaryCodec does
+    stream.precision(17);
+    stream << rows.size() << ' ';
+    for (size_t i = 0; i < rows.size(); ++i)
+    {
+        const Row& row = rows[i];
+        stream << row.id << ' ' << row.name.size() << ' ' << row.name << ' '
+               << row.value << ' ' << row.score << ' ';
+    }
+    out = stream.str();
+}
+
+void StreamDecode(const std::string& data, Row::list& rows)
+{
+    std::istringstream stream(data);
+    size_t count = 0;
+    stream >> count;
+    rows.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        Row& row = rows[i];
+        size_t length = 0;
+        stream >> row.id >> length;
+        stream.get();
+        row.name.resize(length);
+        if (length > 0)
+            stream.read(&row.name[0],
+                        static_cast<std::streamsize>(length));
+        stream >> row.value >> row.score;
+    }
+}
+
+// Encoding and decoding a collection with iostreams and with BinaryCodec.
+void BenchCodec(size_t rows)
+{
+    typedef dm::sql::BinaryCodec<Row, RowMapping> Codec;
+
+    Row::list source = MakeRows(rows, 40);
+    for (size_t i = 0; i < source.size(); ++i)
+        source[i].id = static_cast<int64_t>(i + 1);
+
+    double streamEncode = 1e9, streamDecode = 1e9;
+    double codecEncode = 1e9, codecDecode = 1e9;
+    size_t streamSize = 0, codecSize = 0, checksum = 0;
+
+    for (int run = 0; run < BULK_RUNS; ++run)
+    {
+        std::string data;
+        Row::list decoded;
+
+        dm::sql::Stopwatch stopwatch;
+        StreamEncode(source, data);
+        streamEncode = std::min(streamEncode, stopwatch.elapsedSeconds());
+        streamSize = data.size();
+
+        stopwatch.restart();
+        StreamDecode(data, decoded);
+        streamDecode = std::min(streamDecode, stopwatch.elapsedSeconds());
+        checksum += decoded.size();
+
+        data.clear();
+        decoded.clear();
+
+        stopwatch.restart();
+        Codec::Encode(source, data);
+        codecEncode = std::min(codecEncode, stopwatch.elapsedSeconds());
+        codecSize = data.size();
+
+        stopwatch.restart();
+        Codec::Decode(data, decoded);
+        codecDecode = std::min(codecDecode, stopwatch.elapsedSeconds());
+        checksum += decoded.size();
+    }
+
+    std::printf("Encode and decode %lu rows, %lu bytes as text, %lu bytes "
+                "binary (checksum %lu)\n",
+                static_cast<unsigned long>(rows),
+                static_cast<unsigned long>(streamSize),
+                static_cast<unsigned long>(codecSize),
+                static_cast<unsigned long>(checksum));
+    Report("ostringstream encode", streamEncode, rows);
+    Report("istringstream decode", streamDecode, rows);
+    Report("BinaryCodec::Encode", codecEncode, rows);
+    Report("BinaryCodec::Decode", codecDecode, rows);
+}
+
+#ifdef DATAMAPPERCPP_BENCH_ASYNC
+void ReportLatency(const char* name, double total, double worst, size_t ops)
+{
+    std::printf("  %-44s %9.1f us mean %9.1f us max\n", name,
+                total * 1e6 / static_cast<double>(ops), worst * 1e6);
+}
+
+// Time the event loop thread is blocked per Get(), when it calls the
+// repository itself and when it uses AsyncRepository and only runs the
+// completions.
+void BenchEventLoopLatency(size_t rows)
+{
+    ResetTable(rows, 40);
+
+    EventLoop loop;
+    dm::sql::DbWorker::instance().setCompletionExecutor(
+            [&loop](dm::sql::DbWorker::Job job) { loop.post(job); });
+
+    const size_t ops = std::min<size_t>(rows, 10000);
+    double syncTotal = 0, syncWorst = 0;
+    double asyncTotal = 0, asyncWorst = 0;
+    double roundTripTotal = 0, roundTripWorst = 0;
+    size_t checksum = 0;
+
+    for (size_t i = 0; i < ops; ++i)
+    {
+        dm::sql::Stopwatch stopwatch;
+        checksum += RowRepository::Get(static_cast<int64_t>(i % rows + 1))
+            .name.size();
+        const double blocked = stopwatch.elapsedSeconds();
+        syncTotal += blocked;
+        syncWorst = std::max(syncWorst, blocked);
+    }
+
+    for (size_t i = 0; i < ops; ++i)
+    {
+        dm::sql::Stopwatch stopwatch;
+        RowAsync::GetAsync(static_cast<int64_t>(i % rows + 1),
+                [&checksum](std::exception_ptr , Row row) {
+                    checksum += row.name.size();
+                });
+        double blocked = stopwatch.elapsedSeconds();
+        blocked += loop.runOne();
+        const double roundTrip = stopwatch.elapsedSeconds();
+        roundTripTotal += roundTrip;
+        roundTripWorst = std::max(roundTripWorst, roundTrip);
+        asyncTotal += blocked;
+        asyncWorst = std::max(asyncWorst, blocked);
+    }
+
+    dm::sql::DbWorker::instance().setCompletionExecutor(
+            dm::sql::DbWorker::Executor());
+
+    std::printf("Event loop blocked per Get, %lu rows, %lu gets "
+                "(checksum %lu)\n",
+                static_cast<unsigned long>(rows),
+                static_cast<unsigned long>(ops),
+                static_cast<unsigned long>(checksum));
+    ReportLatency("Repository::Get on the loop", syncTotal, syncWorst, ops);
+    ReportLatency("AsyncRepository::GetAsync, loop side", asyncTotal,
+                  asyncWorst, ops);
+    ReportLatency("AsyncRepository::GetAsync, round trip", roundTripTotal,
+                  roundTripWorst, ops);
+}
+#endif
+
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t rows = argc > 1 ?
+        static_cast<size_t>(std::atol(argv[1])) : 1000000;
+
+    std::remove("bench.sqlite");
+    dm::sql::ConnectDatabase("bench.sqlite");
+
+    const std::string only = argc > 2 ? argv[2] : "";
+
+    if (only.empty() || only == "batch")
+        BenchBatchReuse(rows);
+#ifdef DATAMAPPERCPP_BENCH_ASYNC
+    if (only.empty() || only == "latency")
+        BenchEventLoopLatency(rows);
+#endif
+    if (only.empty() || only == "bulkload")
+        BenchBulkLoad(rows);
+    if (only.empty() || only == "codec")
+        BenchCodec(rows);
+
+    dm::sql::ExecuteStatement("DROP TABLE IF EXISTS "
+                              + RowMapping::getLabel());
+    return 0;
+}
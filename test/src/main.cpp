@@ -1,4 +1,18 @@
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || (__cplusplus > 199711L)
+  #include <datamappercpp/sql/AsyncRepository.h>
+  #include <future>
+#endif
+#include <datamappercpp/sql/BinaryCodec.h>
+#include <datamappercpp/sql/BulkLoad.h>
+#include <datamappercpp/sql/BusyPolicy.h>
+#include <datamappercpp/sql/ChangeFeed.h>
+#include <datamappercpp/sql/MemoryRepository.h>
+#include <datamappercpp/sql/Migration.h>
+#include <datamappercpp/sql/ReadReplica.h>
+#include <datamappercpp/sql/Relation.h>
 #include <datamappercpp/sql/Repository.h>
+#include <datamappercpp/sql/Snapshot.h>
+#include <datamappercpp/sql/SqliteBackend.h>
 #include <datamappercpp/sql/db.h>
 
 #include <datamappercpp/sql/detail/SqlStatementBuilder.h>
@@ -8,8 +22,15 @@
 #include <testcpp/testcpp.h>
 #include <testcpp/StdOutView.h>
 
+#include <sqlite3.h>
+
 #include <iostream>
 #include <functional>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
 
 /* Include <datamappercpp/sql/util/trace.h>
  * and call dm::sql::TraceSqlToStderr();
@@ -58,6 +79,9 @@ void print_person(const Person& p)
 class PersonMapping
 {
 public:
+    // Person ids are plain ints, mappings without id_type use int64_t
+    typedef int id_type;
+
     static std::string getLabel()
     { return "person"; }
 
@@ -80,6 +104,477 @@ public:
 class PersonRepository : public dm::sql::Repository<Person, PersonMapping>
 { };
 
+struct Document
+{
+    typedef std::vector<Document> list;
+
+    int id;
+    std::string title;
+    dm::Lazy<std::string> body;
+
+    Document() :
+        id(-1), title(), body()
+    { }
+
+    Document(const std::string& t, const std::string& b) :
+        id(-1), title(t), body(b)
+    { }
+};
+
+class DocumentMapping
+{
+public:
+    static std::string getLabel()
+    { return "document"; }
+
+    template <class Visitor>
+    static void accept(Visitor& v, Document& d)
+    {
+        v.visitField(dm::Field<std::string>("title"), d.title);
+        v.visitField(dm::Field<dm::Lazy<std::string> >("body"), d.body);
+    }
+
+    static std::string customCreateStatements()
+    { return std::string(); }
+};
+
+class DocumentRepository :
+    public dm::sql::Repository<Document, DocumentMapping>
+{ };
+
+struct Attachment
+{
+    int id;
+    std::string name;
+    dm::Blob contents;
+    dm::Lazy<dm::Blob> preview;
+
+    Attachment() :
+        id(-1), name(), contents(), preview()
+    { }
+};
+
+class AttachmentMapping
+{
+public:
+    static std::string getLabel()
+    { return "attachment"; }
+
+    template <class Visitor>
+    static void accept(Visitor& v, Attachment& a)
+    {
+        v.visitField(dm::Field<std::string>("name"), a.name);
+        v.visitField(dm::Field<dm::Blob>("contents"), a.contents);
+        v.visitField(dm::Field<dm::Lazy<dm::Blob> >("preview"), a.preview);
+    }
+
+    static std::string customCreateStatements()
+    { return std::string(); }
+};
+
+class AttachmentRepository :
+    public dm::sql::Repository<Attachment, AttachmentMapping>
+{ };
+
+struct Measurement
+{
+    int64_t id;
+    int64_t timestampMicros;
+    uint32_t sensor;
+    uint64_t checksum;
+
+    Measurement() :
+        id(-1), timestampMicros(0), sensor(0), checksum(0)
+    { }
+};
+
+class MeasurementMapping
+{
+public:
+    static std::string getLabel()
+    { return "measurement"; }
+
+    template <class Visitor>
+    static void accept(Visitor& v, Measurement& m)
+    {
+        v.visitField(dm::Field<int64_t>("timestamp"), m.timestampMicros);
+        v.visitField(dm::Field<uint32_t>("sensor"), m.sensor);
+        v.visitField(dm::Field<uint64_t>("checksum"), m.checksum);
+    }
+
+    static std::string customCreateStatements()
+    { return std::string(); }
+};
+
+class MeasurementRepository :
+    public dm::sql::Repository<Measurement, MeasurementMapping>
+{ };
+
+struct Book
+{
+    int64_t id;
+    std::string title;
+    int64_t authorId;
+
+    Book() :
+        id(-1), title(), authorId(-1)
+    { }
+
+    Book(const std::string& t, int64_t a) :
+        id(-1), title(t), authorId(a)
+    { }
+};
+
+class BookMapping
+{
+public:
+    static std::string getLabel()
+    { return "book"; }
+
+    template <class Visitor>
+    static void accept(Visitor& v, Book& b)
+    {
+        v.visitField(dm::Field<std::string>("title"), b.title);
+        v.visitField(dm::Field<int64_t>("author_id"), b.authorId);
+    }
+
+    static void declareIndexes(dm::Indexes& indexes)
+    {
+        indexes.push_back(dm::Index("author_id"));
+        indexes.push_back(dm::Index("title").on("author_id").unique()
+                .where("title IS NOT NULL").named("book_title_uniq"));
+    }
+
+    static std::string customCreateStatements()
+    { return std::string(); }
+};
+
+class BookRepository : public dm::sql::Repository<Book, BookMapping>
+{ };
+
+struct Author
+{
+    typedef std::vector<Author> list;
+
+    int64_t id;
+    std::string name;
+    std::vector<Book> books;
+
+    Author() :
+        id(-1), name(), books()
+    { }
+};
+
+class AuthorMapping
+{
+public:
+    static std::string getLabel()
+    { return "author"; }
+
+    template <class Visitor>
+    static void accept(Visitor& v, Author& a)
+    {
+        v.visitField(dm::Field<std::string>("name"), a.name);
+    }
+
+    static std::string customCreateStatements()
+    { return std::string(); }
+
+    typedef dm::sql::OneToMany<Author, Book, BookMapping, int64_t> Books;
+
+    static Books books()
+    { return Books(&Author::books, "author_id", &Book::authorId); }
+};
+
+class AuthorRepository : public dm::sql::Repository<Author, AuthorMapping>
+{ };
+
+struct Review
+{
+    int64_t id;
+    int64_t bookId;
+    Book book;
+
+    Review() :
+        id(-1), bookId(-1), book()
+    { }
+};
+
+class ReviewMapping
+{
+public:
+    static std::string getLabel()
+    { return "review"; }
+
+    template <class Visitor>
+    static void accept(Visitor& v, Review& r)
+    {
+        v.visitField(dm::Field<int64_t>("book_id"), r.bookId);
+    }
+
+    static std::string customCreateStatements()
+    { return std::string(); }
+
+    typedef dm::sql::ManyToOne<Review, Book, BookMapping, int64_t> BookOf;
+
+    static BookOf book()
+    { return BookOf(&Review::book, &Review::bookId); }
+};
+
+class ReviewRepository : public dm::sql::Repository<Review, ReviewMapping>
+{ };
+
+struct Gadget
+{
+    int64_t id;
+    std::string name;
+    int size;
+    std::string code;
+
+    Gadget() :
+        id(-1), name(), size(0), code()
+    { }
+};
+
+class GadgetMapping
+{
+public:
+    static std::string getLabel()
+    { return "gadget"; }
+
+    template <class Visitor>
+    static void accept(Visitor& v, Gadget& g)
+    {
+        v.visitField(dm::Field<std::string>("name"), g.name);
+        v.visitField(dm::Field<int>("size"), g.size);
+        v.visitField(dm::Field<std::string>("code"), g.code);
+    }
+
+    static std::string customCreateStatements()
+    { return std::string(); }
+};
+
+class GadgetRepository : public dm::sql::Repository<Gadget, GadgetMapping>
+{ };
+
+// Same table as GadgetMapping after a schema change that needs copying.
+class NewGadgetMapping
+{
+public:
+    static std::string getLabel()
+    { return "gadget"; }
+
+    template <class Visitor>
+    static void accept(Visitor& v, Gadget& g)
+    {
+        v.visitField(dm::Field<std::string>("name"), g.name);
+        v.visitField(dm::Field<int>("size", "NOT NULL DEFAULT 0"), g.size);
+        v.visitField(dm::Field<std::string>("code", "UNIQUE"), g.code);
+    }
+
+    static void declareIndexes(dm::Indexes& indexes)
+    {
+        indexes.push_back(dm::Index("size"));
+    }
+
+    static std::string customCreateStatements()
+    {
+        return "CREATE INDEX IF NOT EXISTS gadget_name_idx "
+            "ON gadget (name)";
+    }
+};
+
+class NewGadgetRepository :
+    public dm::sql::Repository<Gadget, NewGadgetMapping>
+{ };
+
+struct MigrationProgressCounter
+{
+    std::vector<dm::sql::MigrationProgress>& reports;
+
+    MigrationProgressCounter(std::vector<dm::sql::MigrationProgress>& r) :
+        reports(r)
+    { }
+
+    // writes between chunks are mirrored into the new table
+    void operator()(const dm::sql::MigrationProgress& progress)
+    {
+        if (reports.empty())
+        {
+            dm::sql::ExecuteStatement("UPDATE gadget SET name='renamed' "
+                    "WHERE id=1");
+            dm::sql::ExecuteStatement("INSERT INTO gadget (name,size) "
+                    "VALUES ('late',99)");
+        }
+        reports.push_back(progress);
+    }
+};
+
+struct Ticket
+{
+    int64_t id;
+    std::string title;
+    dm::Version version;
+
+    Ticket() :
+        id(-1), title(), version()
+    { }
+};
+
+class TicketMapping
+{
+public:
+    static std::string getLabel()
+    { return "ticket"; }
+
+    template <class Visitor>
+    static void accept(Visitor& v, Ticket& t)
+    {
+        v.visitField(dm::Field<std::string>("title"), t.title);
+        v.visitField(dm::Field<dm::Version>("version"), t.version);
+    }
+
+    static std::string customCreateStatements()
+    { return std::string(); }
+};
+
+class TicketRepository : public dm::sql::Repository<Ticket, TicketMapping>
+{ };
+
+// Saves a ticket, the first attempt runs into another connection's lock.
+struct LockedTicketSaver
+{
+    sqlite3* otherConnection;
+    int attempts;
+
+    LockedTicketSaver(sqlite3* other) :
+        otherConnection(other), attempts(0)
+    { }
+
+    void operator()()
+    {
+        if (attempts++ > 0)
+            sqlite3_exec(otherConnection, "COMMIT", 0, 0, 0);
+
+        Ticket t;
+        t.title = "busy";
+        TicketRepository::Save(t, false);
+    }
+};
+
+// Forgets to pass enableTransaction = false.
+struct NestedTicketSaver
+{
+    void operator()()
+    {
+        Ticket t;
+        t.title = "nested";
+        TicketRepository::Save(t);
+    }
+};
+
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || (__cplusplus > 199711L)
+typedef dm::sql::AsyncRepository<Ticket, TicketMapping> TicketAsync;
+typedef dm::sql::AsyncRepository<Attachment, AttachmentMapping>
+    AttachmentAsync;
+
+// Completes promise with the ticket or the error of an asynchronous call.
+std::function<void (std::exception_ptr, Ticket)>
+Deliver(std::promise<Ticket>& promise)
+{
+    return [&promise](std::exception_ptr error, Ticket ticket) {
+        if (error)
+            promise.set_exception(error);
+        else
+            promise.set_value(ticket);
+    };
+}
+#endif
+
+#ifdef DATAMAPPERCPP_HAS_COROUTINES
+// Coroutine that starts right away and is destroyed when it finishes.
+struct DetachedCoroutine
+{
+    struct promise_type
+    {
+        DetachedCoroutine get_return_object() { return DetachedCoroutine(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() { }
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+// Saves, loads and deletes a ticket, then counts the remaining ones.
+DetachedCoroutine AwaitTicketOperations(std::promise<size_t>& counted)
+{
+    try
+    {
+        Ticket t;
+        t.title = "awaited";
+        t = co_await TicketAsync::SaveAsync(t);
+
+        Ticket loaded = co_await TicketAsync::GetAsync(t.id);
+        co_await TicketAsync::DeleteAsync(loaded.id);
+
+        size_t rows = 0;
+        TicketAsync::Scan scan(2);
+        for (auto batch = co_await scan.next(); !batch.empty();
+             batch = co_await scan.next())
+            rows += batch.size();
+
+        counted.set_value(rows);
+    }
+    catch (...)
+    {
+        counted.set_exception(std::current_exception());
+    }
+}
+#endif
+
+typedef dm::sql::SnapshotRepository<Person, PersonMapping> PersonSnapshot;
+
+// Keeps the change batches delivered by the change feed.
+struct ChangeCollector
+{
+    std::vector<dm::sql::Changes>* batches;
+
+    ChangeCollector(std::vector<dm::sql::Changes>& b) :
+        batches(&b)
+    { }
+
+    void operator()(const dm::sql::Changes& changes)
+    {
+        batches->push_back(changes);
+    }
+};
+struct ThrowingSubscriber
+{
+    void operator()(const dm::sql::Changes& )
+    {
+        throw std::runtime_error("subscriber failed");
+    }
+};
+
+// Keeps the errors of subscribers reported by the change feed.
+struct SubscriberErrorCollector
+{
+    std::vector<std::string>* errors;
+
+    SubscriberErrorCollector(std::vector<std::string>& e) :
+        errors(&e)
+    { }
+
+    void operator()(const std::string& error, const dm::sql::Changes& )
+    {
+        errors->push_back(error);
+    }
+};
+
+typedef dm::sql::ReplicaRepository<Person, PersonMapping> PersonReplica;
+typedef dm::sql::MemoryRepository<Person, PersonMapping> PersonMemoryRepository;
+typedef dm::sql::MemoryRepository<Ticket, TicketMapping> TicketMemoryRepository;
+
 class TestDataMapperCpp : public Test::Suite
 {
 public:
@@ -94,6 +589,24 @@ public:
     {
         dm::sql::ExecuteStatement(std::string("DROP TABLE IF EXISTS ")
                 + PersonMapping::getLabel());
+        dm::sql::ExecuteStatement(std::string("DROP TABLE IF EXISTS ")
+                + DocumentMapping::getLabel());
+        dm::sql::ExecuteStatement(std::string("DROP TABLE IF EXISTS ")
+                + AttachmentMapping::getLabel());
+        dm::sql::ExecuteStatement(std::string("DROP TABLE IF EXISTS ")
+                + MeasurementMapping::getLabel());
+        dm::sql::ExecuteStatement(std::string("DROP TABLE IF EXISTS ")
+                + BookMapping::getLabel());
+        dm::sql::ExecuteStatement(std::string("DROP TABLE IF EXISTS ")
+                + AuthorMapping::getLabel());
+        dm::sql::ExecuteStatement(std::string("DROP TABLE IF EXISTS ")
+                + ReviewMapping::getLabel());
+        dm::sql::ExecuteStatement(std::string("DROP TABLE IF EXISTS ")
+                + GadgetMapping::getLabel());
+        dm::sql::ExecuteStatement(std::string("DROP TABLE IF EXISTS ")
+                + TicketMapping::getLabel());
+        dm::sql::ExecuteStatement(std::string("DROP TABLE IF EXISTS ")
+                + dm::sql::ChangeFeed::logTable());
     }
 
     void test()
@@ -103,6 +616,26 @@ public:
         testSingleObjectLoading();
         testMultipleObjectLoading();
         testObjectDeletion();
+        testColumnarExportImport();
+        testSnapshotRepository();
+        testMemoryIndexes();
+        testLazyFields();
+        testBlobFields();
+        testWideIntegerFields();
+        testRelations();
+        testSchemaMigration();
+        testIndexDeclarations();
+        testVersionedUpdates();
+        testBusyRetries();
+        testReadReplica();
+        testChangeFeed();
+        testAggregates();
+        testMemoryRepository();
+        testBulkLoad();
+        testBinaryCodec();
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || (__cplusplus > 199711L)
+        testAsyncRepository();
+#endif
         // TODO: test transactions
     }
 
@@ -133,12 +666,18 @@ public:
         Test::assertEqual<std::string>(
                 "Select by ID statement is correct",
                 PersonSql::SelectByIdStatement(),
-                "SELECT * FROM person WHERE id=?");
+                "SELECT id,name,age,height FROM person WHERE id=?");
 
         Test::assertEqual<std::string>(
                 "Select by field statement is correct",
                 PersonSql::SelectByFieldStatement("age"),
-                "SELECT * FROM person WHERE age=?");
+                "SELECT id,name,age,height FROM person WHERE age=?");
+
+        Test::assertEqual<std::string>(
+                "Select by field range statement is correct",
+                PersonSql::SelectByFieldRangeStatement("age"),
+                "SELECT id,name,age,height FROM person "
+                "WHERE age BETWEEN ? AND ?");
     }
 
     void testObjectSaving()
@@ -235,6 +774,15 @@ public:
         Test::assertEqual<Person::list>("Get many objects by statement works",
                 ps, expected);
 
+        Person::list batch;
+        batch.reserve(16);
+        PersonRepository::GetManyByQuery(statement, batch);
+        batch.clear();
+        statement->reset();
+        PersonRepository::GetManyByQuery(statement, batch);
+        Test::assertTrue("Reused batch is refilled in place",
+                batch == expected && batch.capacity() == 16);
+
         ps = PersonRepository::GetManyByField("age", 100);
         expected.clear();
 
@@ -275,6 +823,1425 @@ public:
                 ps, expected);
     }
 
+    void testColumnarExportImport()
+    {
+        Person::list ps;
+        ps.push_back(Person(-1, "Ervin",  38, 1.80));
+        ps.push_back(Person(-1, "Marvin", 24, 1.65));
+        ps.push_back(Person(-1, "Steve",  32, 2.10));
+        PersonRepository::Save(ps);
+
+        dm::ColumnarTable table = PersonRepository::GetAllColumns();
+
+        Test::assertTrue("Columnar export has a column per field",
+                table.size() == 3 && table.columns.size() == 3);
+
+        const dm::ColumnarTable::Column& names = table.column("name");
+        const dm::ColumnarTable::Column& ages = table.column("age");
+        const dm::ColumnarTable::Column& heights = table.column("height");
+
+        Test::assertTrue("Columnar export fills text arena and offsets",
+                names.text == "ErvinMarvinSteve"
+                && names.textAt(1) == "Marvin"
+                && names.textLength(2) == 5);
+
+        Test::assertTrue("Columnar export fills numeric arrays",
+                ages.integers[0] == 38 && ages.integers[2] == 32
+                && heights.reals[1] == 1.65);
+
+        const int64_t lastId = ps.back().id;
+        PersonRepository::DeleteAll();
+        PersonRepository::InsertColumns(table);
+
+        Test::assertTrue("Columnar import assigns ids after deleted rows",
+                table.ids[0] == lastId + 1 && table.ids[2] == lastId + 3);
+
+        Person::list expected;
+        for (size_t i = 0; i < ps.size(); ++i)
+            expected.push_back(Person(table.ids[i], ps[i].name,
+                        ps[i].age, ps[i].height));
+
+        Test::assertEqual<Person::list>("Columnar import inserts all rows",
+                PersonRepository::GetAll(), expected);
+
+        Test::assertThrows<TestDataMapperCpp, TestMethod,
+                           std::invalid_argument>(
+                "Columnar import of wrong column type causes "
+                "invalid_argument exception",
+                *this,
+                &TestDataMapperCpp::ifColumnTypeDiffers_ThenThrowsInvalidArgument);
+
+        Test::assertThrows<TestDataMapperCpp, TestMethod,
+                           std::invalid_argument>(
+                "Columnar import of short column causes invalid_argument "
+                "exception",
+                *this,
+                &TestDataMapperCpp::ifColumnIsShort_ThenThrowsInvalidArgument);
+
+        Test::assertThrows<TestDataMapperCpp, TestMethod,
+                           std::invalid_argument>(
+                "Columnar import of offsets that do not start at 0 causes "
+                "invalid_argument exception",
+                *this,
+                &TestDataMapperCpp::ifOffsetsDoNotStartAtZero_ThenThrowsInvalidArgument);
+
+        Test::assertThrows<TestDataMapperCpp, TestMethod,
+                           std::invalid_argument>(
+                "Columnar import of decreasing offsets causes "
+                "invalid_argument exception",
+                *this,
+                &TestDataMapperCpp::ifOffsetsDecrease_ThenThrowsInvalidArgument);
+
+        Test::assertEqual<Person::list>("Rejected columnar import inserts "
+                "no rows",
+                PersonRepository::GetAll(), expected);
+
+        PersonRepository::DeleteAll();
+    }
+
+    void testSnapshotRepository()
+    {
+        Person::list ps;
+        ps.push_back(Person(-1, "Ervin",  38, 1.80));
+        ps.push_back(Person(-1, "Marvin", 24, 1.65));
+        ps.push_back(Person(-1, "Steve",  24, 2.10));
+        PersonRepository::Save(ps);
+
+        PersonSnapshot::Export("test.snapshot");
+        PersonSnapshot snapshot("test.snapshot");
+
+        Test::assertEqual<Person::list>("Snapshot contains all objects",
+                snapshot.GetAll(), PersonRepository::GetAll());
+
+        Test::assertTrue("Get object by ID from snapshot works",
+                snapshot.Get(ps[1].id) == ps[1]);
+
+        Test::assertTrue("Get object by field from snapshot works",
+                snapshot.GetByField("name", "Steve") == ps[2]
+                && snapshot.GetByField("height", 1.80) == ps[0]);
+
+        Person::list expected;
+        expected.push_back(ps[1]);
+        expected.push_back(ps[2]);
+        Test::assertEqual<Person::list>(
+                "Get many objects by field from snapshot works",
+                snapshot.GetManyByField("age", 24), expected);
+
+        const dm::sql::MappedSnapshot& columns = snapshot.snapshot();
+        const int64_t* ages = columns.integers(columns.columnIndex("age"));
+        Test::assertTrue("Snapshot columns are accessible in place",
+                ages[0] == 38 && ages[1] == 24 && ages[2] == 24);
+
+        Test::assertThrows<TestDataMapperCpp, TestMethod,
+                           dm::sql::DoesNotExistError>(
+                "Missing ID in snapshot causes DoesNotExistError exception",
+                *this,
+                &TestDataMapperCpp::ifNotInSnapshot_ThenThrowsDoesNotExistError);
+
+        Test::assertThrows<TestDataMapperCpp, TestMethod,
+                           dm::sql::SnapshotError>(
+                "Opening invalid snapshot causes SnapshotError exception",
+                *this,
+                &TestDataMapperCpp::ifSnapshotIsInvalid_ThenThrowsSnapshotError);
+
+        Test::assertThrows<TestDataMapperCpp, TestMethod,
+                           dm::sql::SnapshotError>(
+                "Opening snapshot with text offsets past the string heap "
+                "causes SnapshotError exception",
+                *this,
+                &TestDataMapperCpp::ifTextOffsetIsCorrupt_ThenThrowsSnapshotError);
+
+        Test::assertThrows<TestDataMapperCpp, TestMethod,
+                           dm::sql::SnapshotError>(
+                "Opening snapshot with index rows out of bounds causes "
+                "SnapshotError exception",
+                *this,
+                &TestDataMapperCpp::ifIndexRowIsCorrupt_ThenThrowsSnapshotError);
+
+        std::remove("corrupt.snapshot");
+        std::remove("test.snapshot");
+        PersonRepository::DeleteAll();
+    }
+
+    void testMemoryIndexes()
+    {
+        PersonRepository::AddMemoryIndex("name");
+        PersonRepository::AddMemoryIndex("age", dm::sql::SORTED_INDEX);
+
+        Person::list ps;
+        ps.push_back(Person(-1, "Ervin",  38, 1.80));
+        ps.push_back(Person(-1, "Marvin", 24, 1.65));
+        ps.push_back(Person(-1, "Steve",  32, 2.10));
+        PersonRepository::Save(ps);
+
+        Test::assertTrue("Get object by field uses memory index",
+                PersonRepository::GetByField("name", "Marvin") == ps[1]);
+
+        dm::sql::ExecuteStatement("INSERT INTO person (name, age, height) "
+                "VALUES ('Bypass', 50, 1.50)");
+        Test::assertTrue("Memory index does not see changes that bypass "
+                "the repository",
+                PersonRepository::GetManyByField("name", "Bypass").empty());
+
+        PersonRepository::RefreshMemoryIndexes();
+        Test::assertTrue("Refreshing memory index loads the changes",
+                PersonRepository::GetManyByField("name", "Bypass").size() == 1);
+
+        ps[1].age = 33;
+        PersonRepository::Save(ps[1]);
+
+        Person::list expected;
+        expected.push_back(ps[1]);
+        expected.push_back(ps[2]);
+        Test::assertEqual<Person::list>(
+                "Saving updates memory index and range lookups use it",
+                PersonRepository::GetManyByRange("age", 30, 35), expected);
+
+        PersonRepository::Delete(ps[2]);
+        expected.pop_back();
+        Test::assertEqual<Person::list>("Deleting updates memory index",
+                PersonRepository::GetManyByField("age", 33), expected);
+
+        // SQLite compares TEXT columns as text and numeric ones as numbers
+        Person numeric(-1, "42", 42, 1.0);
+        PersonRepository::Save(numeric);
+        Test::assertTrue("Memory index converts values by field affinity",
+                PersonRepository::GetManyByField("name", 42).size() == 1
+                && PersonRepository::Count("name", 42) == 1
+                && PersonRepository::GetManyByField("age",
+                    std::string("42")).size() == 1
+                && PersonRepository::Count("age", std::string("42")) == 1
+                && PersonRepository::GetManyByRange("age",
+                    std::string("40"), std::string("45")).size() == 1);
+
+        PersonRepository::DeleteAll();
+        Test::assertTrue("Deleting all clears memory index",
+                PersonRepository::GetManyByRange("age", 0, 100).empty());
+
+        PersonRepository::DropMemoryIndexes();
+    }
+
+    void testLazyFields()
+    {
+        typedef dm::sql::SqlStatementBuilder<Document, DocumentMapping>
+            DocumentSql;
+
+        Test::assertEqual<std::string>(
+                "Select statements skip lazy fields",
+                DocumentSql::SelectAllStatement(),
+                "SELECT id,title FROM document");
+
+        Test::assertTrue("Lazy fields have the column type of their value",
+                dm::Field<dm::Lazy<int> >("pages").typeDefinition() == "INT"
+                && dm::Field<dm::Lazy<double> >("rating", "NOT NULL")
+                    .typeDefinition() == "REAL NOT NULL"
+                && dm::Field<dm::Lazy<dm::Blob> >("scan").typeDefinition()
+                    == "BLOB");
+
+        DocumentRepository::CreateTable();
+
+        Document::list docs;
+        docs.push_back(Document("First", "Long first body"));
+        docs.push_back(Document("Second", "Long second body"));
+        DocumentRepository::Save(docs);
+
+        Document doc = DocumentRepository::Get(docs[0].id);
+        Test::assertTrue("Lazy field is not loaded with the entity",
+                doc.title == "First" && !doc.body.isLoaded());
+
+        Test::assertTrue("Lazy field is loaded on first access",
+                doc.body.get() == "Long first body" && doc.body.isLoaded());
+
+        doc = DocumentRepository::Get(docs[1].id);
+        doc.title = "Second, revised";
+        DocumentRepository::Save(doc);
+        Test::assertTrue("Saving keeps unloaded lazy field intact",
+                DocumentRepository::Get(doc.id).body.get()
+                == "Long second body");
+
+        Document::list loaded = DocumentRepository::GetAll();
+        DocumentRepository::Prefetch(loaded, "body");
+        Test::assertTrue("Prefetch loads lazy field for all entities",
+                loaded.size() == 2
+                && loaded[0].body.isLoaded() && loaded[1].body.isLoaded()
+                && loaded[0].body.get() == "Long first body"
+                && loaded[1].body.get() == "Long second body");
+
+        dm::ColumnarTable table = DocumentRepository::GetAllColumns();
+        Test::assertTrue("Columnar export includes lazy fields",
+                table.column("body").textAt(1) == "Long second body");
+
+        DocumentRepository::DeleteAll();
+    }
+
+    void testBlobFields()
+    {
+        typedef dm::sql::SqlStatementBuilder<Attachment, AttachmentMapping>
+            AttachmentSql;
+
+        Test::assertEqual<std::string>(
+                "Blob fields are inserted with zeroblob()",
+                AttachmentSql::InsertStatement(),
+                "INSERT INTO attachment (name,contents,preview) "
+                "VALUES (?,zeroblob(?),zeroblob(?))");
+
+        AttachmentRepository::CreateTable();
+
+        Attachment a;
+        a.name = "binary";
+        for (int i = 0; i < 1000; ++i)
+            a.contents.push_back(static_cast<unsigned char>(i % 256));
+        AttachmentRepository::Save(a);
+
+        Attachment loaded = AttachmentRepository::Get(a.id);
+        Test::assertTrue("Blob field round-trips through save and load",
+                loaded.name == "binary" && loaded.contents == a.contents);
+
+        Test::assertEqual<std::string>(
+                "Small blobs are selected as hex text",
+                AttachmentSql::SelectAllStatement(),
+                "SELECT id,name,CASE WHEN contents IS NULL THEN '' "
+                "WHEN length(contents)<=8192 THEN hex(contents) END "
+                "FROM attachment");
+
+        // the ids do not exist, so incremental I/O would fail
+        std::ostringstream shifted;
+        shifted << "SELECT " << AttachmentSql::SelectColumns(false)
+                << " FROM (SELECT id+1000000 AS id,name,contents "
+                << "FROM attachment WHERE id=" << a.id << ")";
+        Test::assertTrue("Small blobs are read from the result set",
+                AttachmentRepository::GetByQuery(shifted.str()).contents
+                == a.contents);
+
+        const size_t chunkSize = 300;
+        const size_t total = 3 * chunkSize;
+        AttachmentRepository::AllocateBlob(a.id, "contents", total);
+        {
+            dm::sql::BlobStream stream(AttachmentMapping::getLabel(),
+                                       "contents", a.id, true);
+            dm::Blob chunk(chunkSize);
+            for (size_t offset = 0; offset < total; offset += chunkSize)
+            {
+                std::fill(chunk.begin(), chunk.end(),
+                          static_cast<unsigned char>(offset / chunkSize + 1));
+                stream.write(dm::BlobSpan(chunk), offset);
+            }
+        }
+
+        unsigned char buffer[2];
+        dm::sql::BlobStream stream(AttachmentMapping::getLabel(),
+                                   "contents", a.id);
+        stream.read(buffer, 2, chunkSize - 1);
+        Test::assertTrue("Blob is written and read in chunks",
+                stream.size() == total && buffer[0] == 1 && buffer[1] == 2);
+
+        loaded = AttachmentRepository::Get(a.id);
+        Test::assertTrue("Blob written in chunks is loaded with entity",
+                loaded.contents.size() == total
+                && loaded.contents.back() == 3);
+
+        loaded.contents.clear();
+        AttachmentRepository::Save(loaded);
+        Test::assertTrue("Empty blob field is saved",
+                AttachmentRepository::Get(a.id).contents.empty());
+
+        Attachment b;
+        b.name = "with preview";
+        b.preview = dm::Blob(500, 7);
+        AttachmentRepository::Save(b);
+
+        loaded = AttachmentRepository::Get(b.id);
+        Test::assertTrue("Lazy blob field is loaded on first access",
+                !loaded.preview.isLoaded()
+                && loaded.preview.get() == b.preview.get());
+
+        loaded = AttachmentRepository::Get(b.id);
+        loaded.name = "with preview, renamed";
+        AttachmentRepository::Save(loaded);
+        Test::assertTrue("Saving keeps unloaded lazy blob field intact",
+                AttachmentRepository::Get(b.id).preview.get()
+                == b.preview.get());
+
+        std::vector<Attachment> all = AttachmentRepository::GetAll();
+        AttachmentRepository::Prefetch(all, "preview");
+        Test::assertTrue("Prefetch loads lazy blob fields",
+                all.size() == 2
+                && all[0].preview.isLoaded() && all[0].preview.get().empty()
+                && all[1].preview.isLoaded()
+                && all[1].preview.get() == b.preview.get());
+
+        Attachment c;
+        c.name = "selected";
+        c.contents = dm::Blob(70000, 9);
+        AttachmentRepository::Save(c);
+
+        std::ostringstream sql;
+        sql << "SELECT * FROM attachment WHERE id=" << c.id;
+        loaded = AttachmentRepository::GetByQuery(sql.str());
+        Test::assertTrue("Blob field is loaded by a SELECT * query",
+                loaded.contents == c.contents);
+
+        AttachmentRepository::Save(loaded);
+        Test::assertTrue("Saving entity from a SELECT * query keeps blob",
+                AttachmentRepository::Get(c.id).contents == c.contents);
+
+        std::ostringstream update;
+        update << "UPDATE attachment SET contents=NULL WHERE id=" << c.id;
+        dm::sql::ExecuteStatement(update.str());
+        Test::assertTrue("NULL blob is loaded as empty",
+                AttachmentRepository::Get(c.id).contents.empty());
+    }
+
+    void testWideIntegerFields()
+    {
+        typedef dm::sql::SqlStatementBuilder<Measurement, MeasurementMapping>
+            MeasurementSql;
+
+        Test::assertEqual<std::string>(
+                "Wide integer fields are declared as INTEGER",
+                MeasurementSql::CreateTableStatement(),
+                "CREATE TABLE IF NOT EXISTS measurement"
+                "(id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                "timestamp INTEGER,"
+                "sensor INTEGER,"
+                "checksum INTEGER)");
+
+        MeasurementRepository::CreateTable();
+        dm::sql::ExecuteStatement("INSERT INTO measurement "
+                "(id,timestamp,sensor,checksum) VALUES (3000000000,0,0,0)");
+
+        Measurement m;
+        m.timestampMicros = INT64_C(1700000000123456);
+        m.sensor = 4000000000U;
+        m.checksum = UINT64_C(0xfedcba9876543210);
+        MeasurementRepository::Save(m);
+
+        Test::assertEqual<int64_t>("Ids above 2^31 are assigned",
+                m.id, INT64_C(3000000001));
+
+        Measurement loaded = MeasurementRepository::Get(m.id);
+        Test::assertTrue("Wide integers round-trip through save and load",
+                loaded.id == m.id
+                && loaded.timestampMicros == m.timestampMicros
+                && loaded.sensor == m.sensor
+                && loaded.checksum == m.checksum);
+
+        m.id = -1;
+        m.checksum = UINT64_C(0x0123456789abcdef);
+        MeasurementRepository::Save(m);
+
+        MeasurementRepository::Entities bySensor =
+            MeasurementRepository::GetManyByField("sensor", m.sensor);
+        Test::assertTrue("Wide integer fields can be queried",
+                bySensor.size() == 2
+                && bySensor.back().checksum == m.checksum);
+
+        // 0xfedcba9876543210 is stored as a negative integer
+        const size_t sqlRange = MeasurementRepository::GetManyByRange(
+                "checksum", UINT64_C(0x8000000000000000), m.checksum).size();
+        MeasurementRepository::AddMemoryIndex("checksum",
+                                              dm::sql::SORTED_INDEX);
+        const size_t memoryRange = MeasurementRepository::GetManyByRange(
+                "checksum", UINT64_C(0x8000000000000000), m.checksum).size();
+        MeasurementRepository::DropMemoryIndexes();
+        Test::assertTrue("Unsigned values from 2^63 order as negative in SQL "
+                "and memory indexes",
+                MeasurementRepository::Max(
+                    dm::Field<uint64_t>("checksum")) == m.checksum
+                && MeasurementRepository::Min(
+                    dm::Field<uint64_t>("checksum"))
+                    == UINT64_C(0xfedcba9876543210)
+                && sqlRange == 3 && memoryRange == 3
+                && MeasurementRepository::GetManyByRange("checksum",
+                    UINT64_C(0), UINT64_C(0xfedcba9876543210)).empty());
+
+        MeasurementRepository::Delete(INT64_C(3000000000));
+        Test::assertEqual<size_t>("Entities with wide ids are deleted",
+                MeasurementRepository::GetAll().size(), 2);
+    }
+
+    void testRelations()
+    {
+        typedef dm::sql::SqlStatementBuilder<Book, BookMapping> BookSql;
+
+        Test::assertEqual<std::string>(
+                "Related entities are selected with IN",
+                BookSql::SelectByFieldValuesStatement("author_id", 2),
+                "SELECT id,title,author_id FROM book "
+                "WHERE author_id IN (?,?)");
+
+        AuthorRepository::CreateTable();
+        BookRepository::CreateTable();
+        ReviewRepository::CreateTable();
+
+        Author::list authors(3);
+        authors[0].name = "Austen";
+        authors[1].name = "Bronte";
+        authors[2].name = "Carroll";
+        AuthorRepository::Save(authors);
+
+        std::vector<Book> books;
+        books.push_back(Book("Emma", authors[0].id));
+        books.push_back(Book("Jane Eyre", authors[1].id));
+        books.push_back(Book("Persuasion", authors[0].id));
+        BookRepository::Save(books);
+
+        authors = AuthorRepository::GetAll();
+        AuthorRepository::LoadRelated(authors, AuthorMapping::books());
+        Test::assertTrue("One-to-many relation is loaded for all parents",
+                authors.size() == 3
+                && authors[0].books.size() == 2
+                && authors[0].books[1].title == "Persuasion"
+                && authors[1].books.size() == 1
+                && authors[2].books.empty());
+
+        std::vector<Review> reviews(2);
+        reviews[0].bookId = books[1].id;
+        reviews[1].bookId = 999;
+        ReviewRepository::Save(reviews);
+
+        reviews = ReviewRepository::GetAll();
+        ReviewRepository::LoadRelated(reviews, ReviewMapping::book());
+        Test::assertTrue("Many-to-one relation is loaded for all entities",
+                reviews[0].book.title == "Jane Eyre"
+                && reviews[1].book.id == -1);
+    }
+
+    void testSchemaMigration()
+    {
+        typedef dm::sql::Migration<Gadget, GadgetMapping> GadgetMigration;
+        typedef dm::sql::Migration<Gadget, NewGadgetMapping>
+            NewGadgetMigration;
+
+        dm::sql::ExecuteStatement("CREATE TABLE gadget "
+                "(id INTEGER PRIMARY KEY AUTOINCREMENT,name TEXT,size TEXT)");
+        for (int i = 0; i < 25; ++i)
+        {
+            std::ostringstream sql;
+            sql << "INSERT INTO gadget (name,size) VALUES "
+                << "('gadget" << i << "','" << i << "')";
+            dm::sql::ExecuteStatement(sql.str());
+        }
+
+        dm::sql::SchemaDiff diff = GadgetMigration::Diff();
+        Test::assertTrue("Schema diff finds added and changed columns",
+                diff.tableExists
+                && diff.added.size() == 1 && diff.added[0].name == "code"
+                && diff.changed.size() == 1 && diff.changed[0].name == "size"
+                && diff.removed.empty() && !diff.additive());
+
+        dm::sql::ExecuteStatement("DROP TABLE gadget");
+        dm::sql::ExecuteStatement("CREATE TABLE gadget "
+                "(id INTEGER PRIMARY KEY AUTOINCREMENT,name TEXT,size INT)");
+        for (int i = 0; i < 25; ++i)
+        {
+            std::ostringstream sql;
+            sql << "INSERT INTO gadget (name,size) VALUES "
+                << "('gadget" << i << "'," << i << ")";
+            dm::sql::ExecuteStatement(sql.str());
+        }
+
+        diff = GadgetMigration::Migrate();
+        Test::assertTrue("Additive change adds the column in place",
+                diff.additive() && diff.added.size() == 1
+                && GadgetMigration::Diff().empty());
+
+        Gadget g = GadgetRepository::Get(3);
+        g.code = "g3";
+        GadgetRepository::Save(g);
+
+        dm::sql::ExecuteStatement("ALTER TABLE gadget "
+                "ADD COLUMN legacy INT DEFAULT 1");
+
+        diff = NewGadgetMigration::Diff();
+        Test::assertTrue("Schema diff finds removed columns",
+                diff.removed.size() == 1 && diff.removed[0] == "legacy");
+
+        Test::assertThrows<TestDataMapperCpp, TestMethod,
+                           dm::sql::MigrationError>(
+                "Dropping unmapped columns without DROP_REMOVED_COLUMNS "
+                "causes MigrationError exception",
+                *this,
+                &TestDataMapperCpp::ifColumnRemovedWithoutDrop_ThenThrowsMigrationError);
+        Test::assertTrue("Refused migration keeps the column",
+                NewGadgetMigration::Diff().removed.size() == 1);
+
+        dm::sql::ExecuteStatement("UPDATE gadget SET code='g3' WHERE id=4");
+        bool migrateThrows = false;
+        try
+        {
+            NewGadgetMigration::Migrate(10,
+                    NewGadgetMigration::ProgressCallback(),
+                    dm::sql::DROP_REMOVED_COLUMNS);
+        }
+        catch (const dbc::DbErrorBase& )
+        {
+            migrateThrows = true;
+        }
+        Test::assertTrue("Constraint violation fails migration and cleans up",
+                migrateThrows && SchemaObjectCount("gadget_migration%") == 0
+                && GadgetRepository::GetAll().size() == 25
+                && NewGadgetMigration::Diff().removed.size() == 1);
+        dm::sql::ExecuteStatement("UPDATE gadget SET code=NULL WHERE id=4");
+
+        dm::sql::ColumnExpressions expressions;
+        expressions["code"] = "coalesce(code,'g'||id)";
+
+        std::vector<dm::sql::MigrationProgress> reports;
+        diff = NewGadgetMigration::Migrate(expressions, 10,
+                MigrationProgressCounter(reports),
+                dm::sql::DROP_REMOVED_COLUMNS);
+        Test::assertTrue("Incompatible change copies the table in chunks",
+                !diff.additive() && diff.changed.size() == 1
+                && diff.removed.size() == 1
+                && NewGadgetMigration::Diff().empty()
+                && SchemaObjectCount("gadget_migration%") == 0
+                && reports.size() == 3
+                && reports.back().rowsCopied == 26
+                && reports.back().totalRows == 25);
+
+        std::vector<Gadget> gadgets = NewGadgetRepository::GetAll();
+        bool valuesKept = gadgets.size() == 26;
+        for (size_t i = 0; valuesKept && i < 25; ++i)
+        {
+            std::ostringstream name, code;
+            if (i == 0)
+                name << "renamed";
+            else
+                name << "gadget" << i;
+            code << "g" << i + 1;
+            valuesKept = gadgets[i].id == static_cast<int64_t>(i + 1)
+                && gadgets[i].name == name.str()
+                && gadgets[i].size == static_cast<int>(i)
+                && gadgets[i].code == code.str();
+        }
+        Test::assertTrue("Rows and concurrent writes are kept by copying migration",
+                valuesKept && gadgets[25].name == "late"
+                && gadgets[25].size == 99 && gadgets[25].code == "g26");
+
+        Test::assertTrue("Indexes built on the copy are renamed in the swap",
+                SchemaObjectCount("gadget_size_idx") == 1
+                && SchemaObjectCount("gadget_name_idx") == 1
+                && IndexCount("gadget") == 2
+                && StringPragmaValue("integrity_check") == "ok"
+                && NewGadgetRepository::GetManyByField("size", 99).size() == 1);
+
+        // the copy never had the deleted last id
+        Gadget tail;
+        tail.name = "tail";
+        NewGadgetRepository::Save(tail);
+        const int64_t tailId = tail.id;
+        NewGadgetRepository::Delete(tail);
+        GadgetMigration::Migrate();
+
+        Gadget next;
+        next.name = "next";
+        GadgetRepository::Save(next);
+        Test::assertTrue("Copying migration keeps the AUTOINCREMENT sequence",
+                tailId == 27 && next.id == 28);
+    }
+
+    void ifColumnRemovedWithoutDrop_ThenThrowsMigrationError()
+    {
+        dm::sql::Migration<Gadget, NewGadgetMapping>::Migrate(10);
+    }
+
+    void testIndexDeclarations()
+    {
+        typedef dm::sql::SqlStatementBuilder<Book, BookMapping> BookSql;
+
+        Test::assertEqual<std::string>(
+                "Indexes declared in mapping are created with the table",
+                BookSql::CreateIndexStatements(),
+                "CREATE INDEX IF NOT EXISTS book_author_id_idx "
+                "ON book (author_id);"
+                "CREATE UNIQUE INDEX IF NOT EXISTS book_title_uniq "
+                "ON book (title,author_id) WHERE title IS NOT NULL");
+
+        dm::sql::SetQueryPlanCheck(dm::sql::QUERY_PLAN_FAIL_ON_SCANS, 1);
+
+        Test::assertEqual<size_t>("Query plan check accepts index lookups",
+                BookRepository::GetManyByField("author_id", 1).size(), 2);
+
+        Test::assertThrows<TestDataMapperCpp, TestMethod,
+                           dm::sql::FullTableScanError>(
+                "Query plan check fails on full table scans",
+                *this,
+                &TestDataMapperCpp::ifFullTableScan_ThenThrowsFullTableScanError);
+
+        Test::assertThrows<TestDataMapperCpp, TestMethod,
+                           dm::sql::FullTableScanError>(
+                "Query plan check finds WHERE after a newline",
+                *this,
+                &TestDataMapperCpp::ifWhereFollowsNewline_ThenThrowsFullTableScanError);
+
+        dm::sql::SetQueryPlanCheck(dm::sql::QUERY_PLAN_CHECK_OFF);
+    }
+
+    void ifFullTableScan_ThenThrowsFullTableScanError()
+    {
+        AuthorRepository::GetByField("name", "Austen");
+    }
+
+    void ifWhereFollowsNewline_ThenThrowsFullTableScanError()
+    {
+        AuthorRepository::GetByQuery("SELECT * FROM author\n"
+                                     "WHERE(name='Austen')");
+    }
+
+    void testVersionedUpdates()
+    {
+        typedef dm::sql::SqlStatementBuilder<Ticket, TicketMapping> TicketSql;
+
+        Test::assertEqual<std::string>(
+                "Versioned insert starts at version 1",
+                TicketSql::InsertStatement(),
+                "INSERT INTO ticket (title,version) VALUES (?,1)");
+
+        Test::assertEqual<std::string>(
+                "Versioned update checks and increments the version",
+                TicketSql::UpdateStatement(),
+                "UPDATE ticket SET title=?,version=version+1 "
+                "WHERE id=? AND version=?");
+
+        TicketRepository::CreateTable();
+
+        Ticket t;
+        t.title = "new";
+        TicketRepository::Save(t);
+
+        Ticket first = TicketRepository::Get(t.id);
+        Ticket second = TicketRepository::Get(t.id);
+
+        first.title = "first";
+        TicketRepository::Save(first);
+        Test::assertTrue("Saving increments the version",
+                t.version.value() == 1 && first.version.value() == 2
+                && TicketRepository::Get(t.id).version == first.version);
+
+        _staleTicket = second;
+        _staleTicket.title = "second";
+        Test::assertThrows<TestDataMapperCpp, TestMethod,
+                           dm::sql::ConcurrentModificationError>(
+                "Saving a stale version causes "
+                "ConcurrentModificationError exception",
+                *this,
+                &TestDataMapperCpp::ifStaleVersion_ThenThrowsConcurrentModificationError);
+
+        Test::assertEqual<std::string>("Stale save does not overwrite",
+                TicketRepository::Get(t.id).title, "first");
+
+        {
+            dm::sql::Transaction transaction;
+            first.title = "rolled back";
+            TicketRepository::Save(first, false);
+            TicketRepository::Save(first, false);
+        }
+        Test::assertTrue("Rollback restores the version of saved entities",
+                first.version.value() == 2);
+
+        first.title = "after rollback";
+        TicketRepository::Save(first);
+        Test::assertTrue("Entity is saved again after rollback",
+                first.version.value() == 3
+                && TicketRepository::Get(t.id).title == "after rollback");
+
+        {
+            dm::sql::Transaction transaction;
+            TicketRepository::Save(first, false);
+            transaction.commit();
+        }
+        Test::assertTrue("Commit keeps the version of saved entities",
+                first.version.value() == 4
+                && TicketRepository::Get(t.id).version == first.version);
+    }
+
+    void ifStaleVersion_ThenThrowsConcurrentModificationError()
+    {
+        TicketRepository::Save(_staleTicket);
+    }
+
+    void testBusyRetries()
+    {
+        dm::sql::SetBusyTimeout(0);
+        dm::sql::ResetBusyStatistics();
+
+        sqlite3* other = 0;
+        sqlite3_open("test.sqlite", &other);
+        sqlite3_exec(other, "BEGIN EXCLUSIVE", 0, 0, 0);
+
+        // passed by reference to count the attempts
+        LockedTicketSaver saver(other);
+        dm::sql::RunInTransaction<LockedTicketSaver&>(saver,
+                dm::sql::BusyPolicy(3, 1, 10));
+
+        sqlite3_close(other);
+
+        dm::sql::BusyStatistics statistics = dm::sql::GetBusyStatistics();
+        Test::assertTrue("Busy transaction is retried after backoff",
+                saver.attempts == 2 && statistics.retries == 1
+                && statistics.failures == 0
+                && statistics.secondsWaited > 0.0
+                && TicketRepository::GetManyByField("title", "busy").size()
+                    == 1);
+
+        dm::sql::SetBusyTimeout(30);
+        sqlite3_open("test.sqlite", &other);
+        sqlite3_exec(other, "BEGIN EXCLUSIVE", 0, 0, 0);
+        bool saveThrows = false;
+        try
+        {
+            Ticket t;
+            t.title = "busy timeout";
+            TicketRepository::Save(t);
+        }
+        catch (const dbc::DbErrorBase& )
+        {
+            saveThrows = true;
+        }
+        sqlite3_close(other);
+        dm::sql::SetBusyTimeout(0);
+
+        statistics = dm::sql::GetBusyStatistics();
+        Test::assertTrue("Waits within the busy timeout are counted",
+                saveThrows && statistics.busyWaits > 0
+                && statistics.secondsBusyWaiting >= 0.025);
+
+        Test::assertThrows<TestDataMapperCpp, TestMethod,
+                           dm::sql::NestedTransactionError>(
+                "Transaction inside RunInTransaction() causes "
+                "NestedTransactionError exception",
+                *this,
+                &TestDataMapperCpp::ifTransactionIsNested_ThenThrowsNestedTransactionError);
+        Test::assertTrue("Nested transaction is rolled back",
+                TicketRepository::GetManyByField("title", "nested").empty());
+    }
+
+    void ifTransactionIsNested_ThenThrowsNestedTransactionError()
+    {
+        dm::sql::RunInTransaction(NestedTicketSaver());
+    }
+
+    void testReadReplica()
+    {
+        dm::sql::ReadReplica::attach(3600);
+
+        const size_t count = PersonRepository::GetAll().size();
+        Test::assertTrue("Replica reads are routed to the replica",
+                PersonReplica::GetAll().size() == count
+                && dm::sql::ReadReplica::table("person") == "replica.person");
+
+        Person p(-1, "Replicated", 51, 1.75);
+        PersonRepository::Save(p);
+        Test::assertTrue("Replica is not refreshed within staleness bound",
+                PersonReplica::GetAll().size() == count);
+
+        dm::sql::ReadReplica::ensureFresh(0.0);
+        Test::assertTrue("Replica is refreshed when older than bound",
+                PersonReplica::GetAll().size() == count + 1
+                && PersonReplica::Get(p.id) == p
+                && PersonReplica::GetManyByField("age", 51).size() == 1);
+
+        dm::sql::ReadReplica::detach();
+        Test::assertTrue("Reads go to the database after detaching",
+                !dm::sql::ReadReplica::attached()
+                && PersonReplica::GetAll().size() == count + 1);
+
+        PersonRepository::Delete(p);
+    }
+
+    void testChangeFeed()
+    {
+        std::vector<dm::sql::Changes> batches;
+        const int handle = dm::sql::ChangeFeed::subscribe(
+                ChangeCollector(batches));
+
+        Person::list ps;
+        ps.push_back(Person(-1, "Feed 1", 1, 1.0));
+        ps.push_back(Person(-1, "Feed 2", 2, 1.0));
+        PersonRepository::Save(ps);
+
+        Test::assertTrue("Changes of a transaction are delivered in a batch",
+                batches.size() == 1
+                && batches[0].size() == 2
+                && batches[0][0].table == "person"
+                && batches[0][0].id == ps[0].id
+                && batches[0][1].operation
+                    == dm::sql::CHANGE_INSERT);
+
+        {
+            dm::sql::Transaction transaction;
+            ps[0].age = 3;
+            PersonRepository::Save(ps[0], false);
+            transaction.rollback();
+        }
+        Test::assertTrue("Rolled back changes are not delivered",
+                batches.size() == 1);
+
+        dm::sql::ExecuteStatement("BEGIN TRANSACTION");
+        PersonRepository::Save(ps[0], false);
+        dm::sql::ExecuteStatement("ROLLBACK TRANSACTION");
+        ps[1].age = 4;
+        PersonRepository::Save(ps[1]);
+        Test::assertTrue("Changes rolled back outside Transaction are "
+                "not delivered",
+                batches.size() == 2 && batches[1].size() == 1
+                && batches[1][0].id == ps[1].id);
+
+        std::vector<dm::sql::Changes> laterBatches;
+        std::vector<std::string> errors;
+        dm::sql::ChangeFeed::setErrorHandler(SubscriberErrorCollector(errors));
+        const int throwing = dm::sql::ChangeFeed::subscribe(
+                ThrowingSubscriber());
+        const int later = dm::sql::ChangeFeed::subscribe(
+                ChangeCollector(laterBatches));
+        bool saveThrows = false;
+        try
+        {
+            PersonRepository::Save(ps[1]);
+        }
+        catch (const std::runtime_error& )
+        {
+            saveThrows = true;
+        }
+        dm::sql::ChangeFeed::unsubscribe(throwing);
+        dm::sql::ChangeFeed::unsubscribe(later);
+        dm::sql::ChangeFeed::setErrorHandler(
+                dm::sql::ChangeFeed::ErrorHandler());
+        Test::assertTrue("Subscriber errors go to the error handler and "
+                "changes still reach all subscribers",
+                !saveThrows && batches.size() == 3
+                && laterBatches.size() == 1
+                && errors.size() == 1 && errors[0] == "subscriber failed");
+        batches.resize(1);
+
+        dm::sql::ChangeFeed::enableChangeLog(true);
+        PersonRepository::Delete(ps[0]);
+        PersonRepository::Delete(ps[1]);
+
+        dm::sql::Changes logged;
+        dm::sql::ChangeFeed::readLog(0, 10, logged);
+        Test::assertTrue("Changes outside transactions are delivered "
+                "immediately and logged",
+                batches.size() == 3
+                && batches[2][0].operation
+                    == dm::sql::CHANGE_DELETE
+                && logged.size() == 2
+                && logged[1].sequence == batches[2][0].sequence
+                && logged[1].id == batches[2][0].id);
+
+        dm::sql::ChangeFeed::truncateLog(logged[1].sequence);
+        logged.clear();
+        dm::sql::ChangeFeed::readLog(0, 10, logged);
+        Test::assertTrue("Truncated changes are removed from the log",
+                logged.empty());
+
+        dm::sql::ChangeFeed::enableChangeLog(false);
+        dm::sql::ChangeFeed::unsubscribe(handle);
+    }
+
+    void testAggregates()
+    {
+        Test::assertEqual<std::string>(
+                "Aggregate statement is correct",
+                (dm::sql::SqlStatementBuilder<Person, PersonMapping>::
+                    AggregateStatement("sum(age)", "name")),
+                "SELECT sum(age) FROM person WHERE name=?");
+
+        Person::list ps;
+        ps.push_back(Person(-1, "Aggregated 1", 70, 1.50));
+        ps.push_back(Person(-1, "Aggregated 2", 70, 1.90));
+        ps.push_back(Person(-1, "Aggregated 3", 71, 1.70));
+        PersonRepository::Save(ps);
+
+        const Person::list all = PersonRepository::GetAll();
+        int ageSum = 0;
+        for (size_t i = 0; i < all.size(); ++i)
+            ageSum += all[i].age;
+
+        Test::assertTrue("Count and Exists are computed in SQL",
+                PersonRepository::Count() == static_cast<int64_t>(all.size())
+                && PersonRepository::Count("age", 70) == 2
+                && PersonRepository::Exists()
+                && PersonRepository::Exists("name", "Aggregated 3")
+                && !PersonRepository::Exists("name", "Nobody"));
+
+        Test::assertTrue("Sum, Min, Max and Avg are computed in SQL",
+                PersonRepository::Sum(dm::Field<int>("age")) == ageSum
+                && PersonRepository::Sum(dm::Field<int>("age"), "age", 70)
+                    == 140
+                && PersonRepository::Sum(dm::Field<int>("age"), "age", -1)
+                    == 0
+                && PersonRepository::Min(dm::Field<double>("height"),
+                                         "age", 70) == 1.50
+                && PersonRepository::Max(dm::Field<double>("height"),
+                                         "age", 70) == 1.90
+                && PersonRepository::Avg(dm::Field<int>("age"),
+                                         "name", "Aggregated 3") == 71.0);
+
+        Person::list large;
+        large.push_back(Person(-1, "Aggregated large 1", 2000000000, 9.5));
+        large.push_back(Person(-1, "Aggregated large 2", 2000000000, 9.5));
+        PersonRepository::Save(large);
+        Test::assertTrue("Sum of an int field does not overflow",
+                PersonRepository::Sum(dm::Field<int>("age"), "height", 9.5)
+                    == static_cast<int64_t>(2000000000) * 2);
+        PersonRepository::Delete(large[0]);
+        PersonRepository::Delete(large[1]);
+
+        Test::assertThrows<TestDataMapperCpp, TestMethod,
+                           dm::sql::DoesNotExistError>(
+                "Maximum of no rows causes DoesNotExistError exception",
+                *this,
+                &TestDataMapperCpp::ifAggregateOfNoRows_ThenThrowsDoesNotExistError);
+
+        for (size_t i = 0; i < ps.size(); ++i)
+            PersonRepository::Delete(ps[i]);
+    }
+
+    void ifAggregateOfNoRows_ThenThrowsDoesNotExistError()
+    {
+        PersonRepository::Max(dm::Field<int>("age"), "name", "Nobody");
+    }
+
+    void testMemoryRepository()
+    {
+        Person::list ps;
+        ps.push_back(Person(-1, "Ervin", 38, 1.80));
+        ps.push_back(Person(-1, "Marvin", 24, 1.65));
+        ps.push_back(Person(-1, "Steve", 24, 2.10));
+        PersonMemoryRepository::Save(ps);
+
+        PersonMemoryRepository::AddMemoryIndex("name");
+        Test::assertTrue("Memory repository finds entities by id and field",
+                ps[2].id == 3
+                && PersonMemoryRepository::Get(2) == ps[1]
+                && PersonMemoryRepository::GetByField("name", "Steve") == ps[2]
+                && PersonMemoryRepository::GetManyByField("age", 24).size()
+                    == 2
+                && PersonMemoryRepository::GetManyByField("age",
+                    std::string("24")).size() == 2
+                && PersonMemoryRepository::GetManyByRange("height",
+                    1.70, 2.50).size() == 2
+                && PersonMemoryRepository::Count() == 3);
+
+        {
+            dm::sql::MemoryTransaction transaction;
+            Person older = ps[0];
+            older.age = 39;
+            PersonMemoryRepository::Save(older);
+            PersonMemoryRepository::Delete(ps[1].id);
+            PersonMemoryRepository::DeleteAll();
+        }
+        Test::assertTrue("Memory transaction is rolled back without commit",
+                PersonMemoryRepository::GetAll() == ps
+                && PersonMemoryRepository::Get(1).age == 38
+                && PersonMemoryRepository::GetByField("name", "Marvin")
+                    == ps[1]);
+
+        Ticket t;
+        t.title = "memory";
+        TicketMemoryRepository::Save(t);
+        Ticket stale = t;
+        TicketMemoryRepository::Save(t);
+        bool staleThrows = false;
+        try
+        {
+            TicketMemoryRepository::Save(stale);
+        }
+        catch (const dm::sql::ConcurrentModificationError& )
+        {
+            staleThrows = true;
+        }
+        Test::assertTrue("Memory repository checks versions",
+                t.version.value() == 2 && staleThrows);
+
+        {
+            dm::sql::MemoryTransaction transaction;
+            TicketMemoryRepository::Save(t);
+        }
+        TicketMemoryRepository::Save(t);
+        Test::assertTrue("Memory rollback restores the version",
+                t.version.value() == 3
+                && TicketMemoryRepository::Get(t.id).version == t.version);
+
+        PersonMemoryRepository::DeleteAll();
+        Test::assertTrue("Memory repository is emptied",
+                PersonMemoryRepository::GetAll().empty()
+                && PersonMemoryRepository::GetManyByField("name",
+                    "Ervin").empty());
+    }
+
+    void testBulkLoad()
+    {
+        typedef dm::sql::BulkLoad<Book, BookMapping> BookBulkLoad;
+
+        std::vector<Book> books;
+        for (int i = 0; i < 5; ++i)
+        {
+            std::ostringstream title;
+            title << "Bulk " << i;
+            books.push_back(Book(title.str(), 1));
+        }
+
+        {
+            BookBulkLoad load(2);
+            const int indexesDuringLoad = IndexCount("book");
+            load.insert(books);
+            load.finish();
+
+            Test::assertTrue("Non-unique indexes are dropped during bulk "
+                    "load and recreated after it",
+                    indexesDuringLoad == 1 && IndexCount("book") == 2
+                    && books[4].id > books[0].id
+                    && BookRepository::Count("title", "Bulk 4") == 1
+                    && PragmaValue("synchronous") != 0);
+        }
+
+        books.resize(2);
+        books[0].id = -1;
+        books[1].id = -1;
+        books[0].title = "Bulk duplicate";
+        books[1].title = "Bulk duplicate";
+        bool insertThrows = false;
+        bool finishThrows = false;
+        {
+            BookBulkLoad load;
+            try
+            {
+                load.insert(books);
+            }
+            catch (const dbc::DbErrorBase& )
+            {
+                insertThrows = true;
+            }
+
+            // recreating book_author_id_idx fails while the column is renamed
+            dm::sql::ExecuteStatement("ALTER TABLE book "
+                    "RENAME COLUMN author_id TO writer_id");
+            try
+            {
+                load.finish();
+            }
+            catch (const dm::sql::BulkLoadError& )
+            {
+                finishThrows = true;
+            }
+            const int indexesAfterFailure = IndexCount("book");
+
+            dm::sql::ExecuteStatement("ALTER TABLE book "
+                    "RENAME COLUMN writer_id TO author_id");
+            load.finish();
+
+            // the failed batch is rolled back as a whole
+            Test::assertTrue("Unique indexes are kept during bulk load",
+                    insertThrows
+                    && BookRepository::Count("title", "Bulk duplicate") == 0);
+            Test::assertTrue("Failed index recreation can be retried",
+                    finishThrows && indexesAfterFailure == 1
+                    && IndexCount("book") == 2
+                    && PragmaValue("synchronous") != 0);
+        }
+    }
+
+    void testBinaryCodec()
+    {
+        typedef dm::sql::BinaryCodec<Person, PersonMapping> PersonCodec;
+        typedef dm::sql::BinaryCodec<Measurement, MeasurementMapping>
+            MeasurementCodec;
+        typedef dm::sql::BinaryCodec<Attachment, AttachmentMapping>
+            AttachmentCodec;
+        typedef dm::sql::BinaryCodec<Ticket, TicketMapping> TicketCodec;
+        typedef dm::sql::BinaryCodec<Document, DocumentMapping> DocumentCodec;
+
+        Person p(3, "Ervin", 38, 1.80);
+        const std::string encoded = PersonCodec::Encode(p);
+        // version, id, length and name, age, height
+        Test::assertEqual<size_t>("Small integers take one byte",
+                encoded.size(), 1 + 1 + 1 + 5 + 1 + 8);
+        Test::assertTrue("Entity is decoded", PersonCodec::Decode(encoded) == p);
+
+        Measurement m;
+        m.id = INT64_C(-9223372036854775807) - 1;
+        m.timestampMicros = INT64_C(9223372036854775807);
+        m.sensor = 4294967295U;
+        m.checksum = UINT64_C(18446744073709551615);
+        Measurement decoded = MeasurementCodec::Decode(
+                MeasurementCodec::Encode(m));
+        Test::assertTrue("Integer limits survive encoding",
+                decoded.id == m.id
+                && decoded.timestampMicros == m.timestampMicros
+                && decoded.sensor == m.sensor
+                && decoded.checksum == m.checksum);
+
+        Attachment a;
+        a.name = std::string("with\0zero", 9);
+        a.contents.push_back(0);
+        a.contents.push_back(255);
+        Ticket t;
+        t.title = "encoded";
+        t.version.set(7);
+        Document d("title", "body");
+        Test::assertTrue("Blobs, versions and lazy fields are encoded",
+                AttachmentCodec::Decode(AttachmentCodec::Encode(a)).contents
+                    == a.contents
+                && AttachmentCodec::Decode(AttachmentCodec::Encode(a)).name
+                    == a.name
+                && TicketCodec::Decode(TicketCodec::Encode(t)).version
+                    == t.version
+                && DocumentCodec::Decode(DocumentCodec::Encode(d)).body.get()
+                    == "body");
+
+        Person::list ps;
+        ps.push_back(p);
+        ps.push_back(Person(-1, "", -5, -0.5));
+        Person::list decodedPersons;
+        PersonCodec::Decode(PersonCodec::Encode(ps), decodedPersons);
+        Test::assertTrue("Entity collections are decoded",
+                decodedPersons == ps);
+
+        Test::assertThrows<TestDataMapperCpp, TestMethod,
+                           dm::sql::CodecError>(
+                "Decoding truncated data causes CodecError exception",
+                *this,
+                &TestDataMapperCpp::ifBinaryDataIsTruncated_ThenThrowsCodecError);
+    }
+
+    void ifBinaryDataIsTruncated_ThenThrowsCodecError()
+    {
+        typedef dm::sql::BinaryCodec<Person, PersonMapping> PersonCodec;
+
+        std::string encoded = PersonCodec::Encode(Person(1, "Ervin", 38, 1.8));
+        encoded.resize(encoded.size() - 1);
+        PersonCodec::Decode(encoded);
+    }
+
+    static int IndexCount(const std::string& table)
+    {
+        dm::sql::Statement statement = dm::sql::PrepareStatement(
+                "SELECT count(*) FROM sqlite_master WHERE type='index' "
+                "AND tbl_name=? AND sql IS NOT NULL");
+        *statement << table;
+        dbc::ResultSet::ptr result(statement->executeQuery());
+        result->next();
+        return result->get<int>(0);
+    }
+
+    static int SchemaObjectCount(const std::string& namePattern)
+    {
+        dm::sql::Statement statement = dm::sql::PrepareStatement(
+                "SELECT count(*) FROM sqlite_master WHERE name LIKE ?");
+        *statement << namePattern;
+        dbc::ResultSet::ptr result(statement->executeQuery());
+        result->next();
+        return result->get<int>(0);
+    }
+
+    static int PragmaValue(const std::string& pragma)
+    {
+        dm::sql::Statement statement = dm::sql::PrepareStatement(
+                "PRAGMA " + pragma);
+        dbc::ResultSet::ptr result(statement->executeQuery());
+        result->next();
+        return result->get<int>(0);
+    }
+
+    static std::string StringPragmaValue(const std::string& pragma)
+    {
+        dm::sql::Statement statement = dm::sql::PrepareStatement(
+                "PRAGMA " + pragma);
+        dbc::ResultSet::ptr result(statement->executeQuery());
+        result->next();
+        return result->get<std::string>(0);
+    }
+
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || (__cplusplus > 199711L)
+    void testAsyncRepository()
+    {
+        Ticket t;
+        t.title = "async";
+
+        std::promise<Ticket> saved;
+        TicketAsync::SaveAsync(t, Deliver(saved));
+        t = saved.get_future().get();
+
+        std::promise<Ticket> loaded;
+        TicketAsync::GetAsync(t.id, Deliver(loaded));
+        Ticket l = loaded.get_future().get();
+        Test::assertTrue("Asynchronously saved entity is loaded",
+                t.id > 0 && l.title == "async" && l.version.value() == 1);
+
+        std::promise<Ticket> missing;
+        TicketAsync::GetAsync(424242, Deliver(missing));
+        bool missingThrows = false;
+        try
+        {
+            missing.get_future().get();
+        }
+        catch (const dm::sql::DoesNotExistError& )
+        {
+            missingThrows = true;
+        }
+        Test::assertTrue("Asynchronous errors are delivered to the callback",
+                missingThrows);
+
+        Attachment a;
+        a.name = "async";
+        a.contents = dm::Blob(100, 1);
+        a.preview = dm::Blob(10, 2);
+        AttachmentRepository::Save(a);
+
+        std::promise<Attachment> attachment;
+        AttachmentAsync::GetAsync(a.id, [&attachment](std::exception_ptr error,
+                                                      Attachment loaded) {
+            if (error)
+                attachment.set_exception(error);
+            else
+                attachment.set_value(loaded);
+        });
+        Attachment la = attachment.get_future().get();
+        Test::assertTrue("Lazy and blob fields are loaded on the worker",
+                la.preview.isLoaded() && la.preview.get() == a.preview.get()
+                && la.contents == a.contents);
+        AttachmentRepository::Delete(a);
+
+        size_t rows = 0, batches = 0;
+        std::promise<void> scanned;
+        TicketAsync::ScanAsync(2,
+                [&rows, &batches](TicketAsync::Entities& batch) {
+                    rows += batch.size();
+                    ++batches;
+                    return true;
+                },
+                [&scanned](std::exception_ptr error) {
+                    if (error)
+                        scanned.set_exception(error);
+                    else
+                        scanned.set_value();
+                });
+        scanned.get_future().get();
+
+        const size_t count = TicketRepository::GetAll().size();
+        Test::assertTrue("Asynchronous scan streams all rows in batches",
+                rows == count && batches == (count + 1) / 2);
+
+#ifdef DATAMAPPERCPP_HAS_COROUTINES
+        std::promise<size_t> counted;
+        AwaitTicketOperations(counted);
+        Test::assertTrue("Awaited operations run on the worker",
+                counted.get_future().get() == count);
+#endif
+    }
+#endif
+
+    dm::ColumnarTable ValidPersonColumns()
+    {
+        dm::ColumnarTable table;
+        table.columns.push_back(dm::ColumnarTable::Column("name",
+                    dm::ColumnarTable::TEXT_COLUMN));
+        table.columns.push_back(dm::ColumnarTable::Column("age",
+                    dm::ColumnarTable::INTEGER_COLUMN));
+        table.columns.push_back(dm::ColumnarTable::Column("height",
+                    dm::ColumnarTable::REAL_COLUMN));
+
+        for (int i = 0; i < 2; ++i)
+        {
+            table.columns[0].text += "Zaphod";
+            table.columns[0].offsets.push_back(table.columns[0].text.size());
+            table.columns[1].integers.push_back(42);
+            table.columns[2].reals.push_back(1.9);
+        }
+        return table;
+    }
+
+    void ifColumnTypeDiffers_ThenThrowsInvalidArgument()
+    {
+        dm::ColumnarTable table = ValidPersonColumns();
+        table.columns[1].type = dm::ColumnarTable::REAL_COLUMN;
+        table.columns[1].reals.resize(2);
+        PersonRepository::InsertColumns(table);
+    }
+
+    void ifColumnIsShort_ThenThrowsInvalidArgument()
+    {
+        dm::ColumnarTable table = ValidPersonColumns();
+        table.columns[2].reals.pop_back();
+        PersonRepository::InsertColumns(table);
+    }
+
+    void ifOffsetsDoNotStartAtZero_ThenThrowsInvalidArgument()
+    {
+        dm::ColumnarTable table = ValidPersonColumns();
+        table.columns[0].offsets[0] = 3;
+        PersonRepository::InsertColumns(table);
+    }
+
+    void ifOffsetsDecrease_ThenThrowsInvalidArgument()
+    {
+        dm::ColumnarTable table = ValidPersonColumns();
+        table.columns[0].offsets[1] = 10;
+        table.columns[0].offsets[2] = 6;
+        PersonRepository::InsertColumns(table);
+    }
+
+    void ifNotInSnapshot_ThenThrowsDoesNotExistError()
+    {
+        PersonSnapshot snapshot("test.snapshot");
+        snapshot.Get(42);
+    }
+
+    void ifSnapshotIsInvalid_ThenThrowsSnapshotError()
+    {
+        PersonSnapshot snapshot("test.sqlite");
+    }
+
+    // Copies test.snapshot to corrupt.snapshot with either the last text
+    // offset of the first column or the row of the first index entry out
+    // of bounds.
+    void WriteCorruptSnapshot(bool corruptIndex)
+    {
+        using namespace dm::sql::snapshot;
+
+        std::ifstream in("test.snapshot", std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+
+        Header header;
+        std::memcpy(&header, data.data(), sizeof(header));
+
+        if (corruptIndex)
+        {
+            IndexEntry entry;
+            std::memcpy(&entry, &data[header.indexOffset], sizeof(entry));
+            entry.row = header.rowCount;
+            std::memcpy(&data[header.indexOffset], &entry, sizeof(entry));
+        }
+        else
+        {
+            ColumnHeader column;
+            std::memcpy(&column, &data[sizeof(Header)], sizeof(column));
+            const uint64_t pastHeap = column.dataSize + 1;
+            std::memcpy(&data[column.offsetsOffset
+                              + header.rowCount * sizeof(uint64_t)],
+                        &pastHeap, sizeof(pastHeap));
+        }
+
+        std::ofstream out("corrupt.snapshot", std::ios::binary);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+
+    void ifTextOffsetIsCorrupt_ThenThrowsSnapshotError()
+    {
+        WriteCorruptSnapshot(false);
+        PersonSnapshot snapshot("corrupt.snapshot");
+    }
+
+    void ifIndexRowIsCorrupt_ThenThrowsSnapshotError()
+    {
+        WriteCorruptSnapshot(true);
+        PersonSnapshot snapshot("corrupt.snapshot");
+    }
+
     void ifDoesNotExist_ThenThrowsDoesNotExistError()
     {
         PersonRepository::Get(42);
@@ -291,6 +2258,8 @@ public:
         PersonRepository::Get(1);
     }
 
+    Ticket _staleTicket;
+
     /*
     void testUpdate()
     {